@@ -0,0 +1,270 @@
+/*
+ Mal
+ https://github.com/brackeen/mal
+ Copyright (c) 2014-2018 David Brackeen
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Headless benchmark of mal's hot paths. Uses the null audio system, so malContextRender() acts
+// as the sound server's device loop. Results are printed as JSON lines, one result per line.
+
+#if !defined(_WIN32)
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "mal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+#define kSampleRate 48000
+#define kPeriodFrames 1024
+#define kNumRenderPlayers 32
+
+static double benchNow(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static void *benchCreateData(MalFormat format, uint32_t numFrames) {
+    const size_t sampleSize = format.bitDepth / 8;
+    const size_t numSamples = (size_t)numFrames * format.numChannels;
+    uint8_t *data = malloc(numSamples * sampleSize);
+    if (!data) {
+        return NULL;
+    }
+    // Arbitrary non-silent data. The value doesn't affect timing.
+    for (size_t i = 0; i < numSamples; i++) {
+        if (format.isFloat) {
+            ((float *)data)[i] = (float)(i % 200) / 100.0f - 1.0f;
+        } else if (format.bitDepth == 8) {
+            data[i] = (uint8_t)(i % 256);
+        } else {
+            ((int16_t *)data)[i] = (int16_t)((i % 200) * 300 - 30000);
+        }
+    }
+    return data;
+}
+
+static const char *benchFormatName(MalFormat format) {
+    static char name[64];
+    const char *type = format.isFloat ? "f" : (format.bitDepth == 8 ? "u" : "s");
+    snprintf(name, sizeof(name), "%s%i-%s-%i", type, format.bitDepth,
+             format.numChannels == 1 ? "mono" : "stereo", (int)format.sampleRate);
+    return name;
+}
+
+static void benchRender(MalContext *context, MalFormat format, double seconds) {
+    const uint32_t bufferFrames = (uint32_t)format.sampleRate; // 1 second
+    void *data = benchCreateData(format, bufferFrames);
+    MalBuffer *buffer = malBufferCreateNoCopy(context, format, bufferFrames, data, free);
+    MalPlayer *players[kNumRenderPlayers];
+    for (int i = 0; i < kNumRenderPlayers; i++) {
+        players[i] = malPlayerCreate(context, format);
+        malPlayerSetBuffer(players[i], buffer);
+        malPlayerSetLooping(players[i], true);
+        malPlayerSetGain(players[i], 1.0f / kNumRenderPlayers);
+        malPlayerSetState(players[i], MAL_PLAYER_STATE_PLAYING);
+    }
+
+    float *out = malloc(sizeof(float) * 2 * kPeriodFrames);
+    uint64_t numPeriods = 0;
+    const uint64_t startBytesCopied = malContextGetRenderStats(context).bytesCopied;
+    double start = benchNow();
+    double elapsed;
+    do {
+        for (int i = 0; i < 16; i++) {
+            malContextRender(context, kPeriodFrames, out);
+        }
+        numPeriods += 16;
+        elapsed = benchNow() - start;
+    } while (elapsed < seconds);
+
+    const double outputFrames = (double)numPeriods * kPeriodFrames;
+    const double voiceFrames = outputFrames * kNumRenderPlayers;
+    const double bytesCopied = (double)(malContextGetRenderStats(context).bytesCopied -
+                                        startBytesCopied);
+    printf("{\"benchmark\": \"render\", \"format\": \"%s\", \"players\": %i, "
+           "\"output_frames_per_second\": %.0f, \"voice_frames_per_second\": %.0f, "
+           "\"ns_per_voice_frame\": %.3f, \"realtime_factor\": %.1f, "
+           "\"bytes_copied_per_second\": %.0f}\n",
+           benchFormatName(format), kNumRenderPlayers, outputFrames / elapsed,
+           voiceFrames / elapsed, elapsed * 1e9 / voiceFrames,
+           outputFrames / kSampleRate / elapsed, bytesCopied / elapsed);
+
+    free(out);
+    for (int i = 0; i < kNumRenderPlayers; i++) {
+        malPlayerRelease(players[i]);
+    }
+    malBufferRelease(buffer);
+}
+
+static void benchPlayerCreateRelease(MalContext *context, int iterations) {
+    MalFormat format = { kSampleRate, 16, 2, false };
+    MalPlayer **players = malloc(sizeof(MalPlayer *) * (size_t)iterations);
+
+    double start = benchNow();
+    for (int i = 0; i < iterations; i++) {
+        players[i] = malPlayerCreate(context, format);
+    }
+    double createTime = benchNow() - start;
+
+    // Release in creation order, which is the worst case for the player list
+    start = benchNow();
+    for (int i = 0; i < iterations; i++) {
+        malPlayerRelease(players[i]);
+    }
+    double releaseTime = benchNow() - start;
+
+    // Create and release one at a time
+    start = benchNow();
+    for (int i = 0; i < iterations; i++) {
+        malPlayerRelease(malPlayerCreate(context, format));
+    }
+    double pairTime = benchNow() - start;
+
+    printf("{\"benchmark\": \"player_create_release\", \"live_players\": %i, "
+           "\"ns_per_create\": %.1f, \"ns_per_release\": %.1f, "
+           "\"ns_per_create_release_pair\": %.1f}\n",
+           iterations, createTime * 1e9 / iterations, releaseTime * 1e9 / iterations,
+           pairTime * 1e9 / iterations);
+    free(players);
+}
+
+static void benchBufferCreate(MalContext *context, uint32_t numFrames, int iterations) {
+    MalFormat format = { kSampleRate, 16, 2, false };
+    void *data = benchCreateData(format, numFrames);
+
+    double start = benchNow();
+    for (int i = 0; i < iterations; i++) {
+        malBufferRelease(malBufferCreate(context, format, numFrames, data));
+    }
+    double copyTime = benchNow() - start;
+
+    start = benchNow();
+    for (int i = 0; i < iterations; i++) {
+        malBufferRelease(malBufferCreateNoCopy(context, format, numFrames, data, NULL));
+    }
+    double noCopyTime = benchNow() - start;
+
+    printf("{\"benchmark\": \"buffer_create\", \"bytes\": %lu, "
+           "\"ns_per_create\": %.1f, \"ns_per_create_no_copy\": %.1f}\n",
+           (unsigned long)numFrames * 4, copyTime * 1e9 / iterations,
+           noCopyTime * 1e9 / iterations);
+    free(data);
+}
+
+static void benchOnFinished(MalPlayer *player, void *userData) {
+    (void)player;
+    (*(int *)userData)++;
+}
+
+static void benchPollEvents(MalContext *context, int numEvents) {
+    MalFormat format = { kSampleRate, 16, 2, false };
+    const uint32_t bufferFrames = 64;
+    void *data = benchCreateData(format, bufferFrames);
+    MalBuffer *buffer = malBufferCreateNoCopy(context, format, bufferFrames, data, free);
+    MalPlayer **players = malloc(sizeof(MalPlayer *) * (size_t)numEvents);
+    int numFinished = 0;
+    for (int i = 0; i < numEvents; i++) {
+        players[i] = malPlayerCreate(context, format);
+        malPlayerSetBuffer(players[i], buffer);
+        malPlayerSetFinishedFunc(players[i], benchOnFinished, &numFinished);
+        malPlayerSetState(players[i], MAL_PLAYER_STATE_PLAYING);
+    }
+
+    // Two periods: the first plays the whole buffer, the second is a no-op
+    float *out = malloc(sizeof(float) * 2 * kPeriodFrames);
+    malContextRender(context, kPeriodFrames, out);
+    malContextRender(context, kPeriodFrames, out);
+    free(out);
+
+    double start = benchNow();
+    malContextPollEvents(context);
+    double drainTime = benchNow() - start;
+
+    const int emptyIterations = 100000;
+    start = benchNow();
+    for (int i = 0; i < emptyIterations; i++) {
+        malContextPollEvents(context);
+    }
+    double emptyTime = benchNow() - start;
+
+    printf("{\"benchmark\": \"poll_events\", \"events\": %i, \"events_delivered\": %i, "
+           "\"ns_per_event\": %.1f, \"ns_per_empty_poll\": %.1f}\n",
+           numEvents, numFinished, drainTime * 1e9 / numEvents, emptyTime * 1e9 / emptyIterations);
+
+    for (int i = 0; i < numEvents; i++) {
+        malPlayerRelease(players[i]);
+    }
+    free(players);
+    malBufferRelease(buffer);
+}
+
+int main(int argc, char *argv[]) {
+    // Pass "--quick" for a short smoke-test run
+    const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const double renderSeconds = quick ? 0.05 : 1.0;
+    const int scale = quick ? 10 : 1;
+
+    MalContextConfig config = malContextGetDefaultConfig();
+    config.sampleRate = kSampleRate;
+    MalContext *context = malContextCreateWithConfig(&config, NULL);
+    if (!context) {
+        fprintf(stderr, "Error: Couldn't create audio context\n");
+        return EXIT_FAILURE;
+    }
+
+    const MalFormat renderFormats[] = {
+        { kSampleRate, 8, 1, false },
+        { kSampleRate, 16, 1, false },
+        { kSampleRate, 16, 2, false },
+        { kSampleRate, 32, 2, true },
+        { 22050, 16, 1, false },
+        { 44100, 16, 2, false },
+    };
+    for (size_t i = 0; i < sizeof(renderFormats) / sizeof(*renderFormats); i++) {
+        benchRender(context, renderFormats[i], renderSeconds);
+    }
+
+    benchPlayerCreateRelease(context, 10000 / scale);
+
+    for (uint32_t numFrames = 256; numFrames <= (1 << 22); numFrames *= 16) {
+        int iterations = (int)((1 << 26) / numFrames) / scale;
+        benchBufferCreate(context, numFrames, iterations > 1000 ? 1000 : iterations + 1);
+    }
+
+    benchPollEvents(context, 10000 / scale);
+
+    malContextRelease(context);
+    return EXIT_SUCCESS;
+}
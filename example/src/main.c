@@ -100,7 +100,8 @@ static bool malExampleInit(ExampleApp *app) {
         MalFormat format = {
             .sampleRate = wav->sample_rate,
             .numChannels = wav->num_channels,
-            .bitDepth = wav->bit_depth
+            .bitDepth = wav->bit_depth,
+            .isFloat = wav->is_float
         };
         if (!malContextIsFormatValid(app->context, format)) {
             printf("Error: Audio format is invalid\n");
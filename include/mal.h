@@ -28,11 +28,14 @@
  * Provides functions to play raw PCM audio on Windows, macOS, Linux, iOS, Android, and Emscripten.
  *
  * Uses the platform's audio system (XAudio2, PulseAudio, Core Audio, OpenSL ES, Web Audio).
- * No sofware audio rendering, no software mixing, no extra buffering.
+ * No sofware audio rendering, no extra buffering. By default, no software mixing (see
+ * #MalContextConfig::softwareMixing).
  *
  * Caveats:
- * - No audio file format decoding. Bring your own WAV decoder.
- * - No streaming. All audio files must be fully decoded into memory.
+ * - Minimal audio file format decoding. Only uncompressed and ADPCM WAV files can be loaded
+ *   (see #malBufferCreateFromFile()). Otherwise, bring your own decoder.
+ * - Streaming (see #MalStream) is only available on PulseAudio and the null audio system.
+ *   Elsewhere, all audio files must be fully decoded into memory.
  * - No effects.
  */
 
@@ -49,24 +52,208 @@ typedef enum {
     MAL_PLAYER_STATE_PAUSED,
 } MalPlayerState;
 
+/**
+ * The quality of the resampler used by #malBufferCreateResampled(). Higher quality uses a longer
+ * filter, which attenuates aliasing more and keeps more of the high frequencies, at the cost of
+ * more CPU time when resampling.
+ */
+typedef enum {
+    MAL_RESAMPLE_QUALITY_LOW = 0,
+    MAL_RESAMPLE_QUALITY_MEDIUM,
+    MAL_RESAMPLE_QUALITY_HIGH,
+} MalResampleQuality;
+
+/**
+ * The encoding of the data passed to #malBufferCreateAdpcm().
+ */
+typedef enum {
+    /**
+     * IMA ADPCM, as stored in WAV files (format tag 0x11). Each block starts with a 4-byte header
+     * per channel, followed by groups of 4 bytes (8 samples) per channel.
+     */
+    MAL_ADPCM_ENCODING_IMA = 0,
+    /**
+     * Microsoft ADPCM, as stored in WAV files (format tag 0x02), with the standard coefficient
+     * table. Each block starts with a 7-byte header per channel, followed by interleaved samples.
+     */
+    MAL_ADPCM_ENCODING_MS,
+} MalAdpcmEncoding;
+
 typedef struct {
     double sampleRate;
+    /**
+     * The number of bits per sample: 8 (unsigned), 16, 24, or 32. Samples are in native byte
+     * order, and 24-bit samples are packed into 3 bytes.
+     */
     uint8_t bitDepth;
+    /**
+     * The number of interleaved channels. Sources with 3 to 8 channels use the WAVE default
+     * speaker order:
+     *
+     * - 3: FL, FR, FC
+     * - 4: FL, FR, BL, BR
+     * - 5: FL, FR, FC, BL, BR
+     * - 6 (5.1): FL, FR, FC, LFE, BL, BR
+     * - 7 (6.1): FL, FR, FC, LFE, BC, SL, SR
+     * - 8 (7.1): FL, FR, FC, LFE, BL, BR, SL, SR
+     *
+     * When mixed to stereo, surround channels are downmixed and the LFE channel is dropped.
+     */
     uint8_t numChannels;
+    /**
+     * If `true`, samples are 32-bit floating point (`bitDepth` must be 32), nominally in the
+     * range -1.0 to 1.0. Otherwise, samples are linear PCM integers.
+     */
+    bool isFloat;
 } MalFormat;
 
 typedef struct MalContext MalContext;
 typedef struct MalBuffer MalBuffer;
 typedef struct MalPlayer MalPlayer;
+typedef struct MalStream MalStream;
 
 typedef void (*malDeallocatorFunc)(void *);
 typedef void (*malPlaybackFinishedFunc)(MalPlayer *player, void *userData);
+typedef void (*malStreamFunc)(MalStream *stream, void *userData);
+typedef void (*malContextReadyFunc)(MalContext *context, bool success, void *userData);
 
 /**
  * The value to use in the #malContextCreate() call to use the default platform sample rate.
  */
 #define MAL_DEFAULT_SAMPLE_RATE 0.0
 
+/**
+ * Options for creating a context with #malContextCreateWithConfig(). Use
+ * #malContextGetDefaultConfig() to get a config with the default values.
+ */
+typedef struct {
+    /**
+     * The requested output sample rate. See #malContextCreateWithOptions().
+     */
+    double sampleRate;
+    /**
+     * A reference to an `ANativeActivity` instance. See #malContextCreateWithOptions().
+     */
+    void *androidActivity;
+    /**
+     * If `true`, the context owns one output stream, and all players are mixed into it in
+     * software. This removes the audio system's limit on the number of players, and the
+     * per-player server cost. Currently only used by PulseAudio; ignored on other platforms.
+     */
+    bool softwareMixing;
+    /**
+     * The maximum number of players in the context's voice pool, used by #malContextPlay().
+     * The default is 16.
+     */
+    uint32_t maxVoices;
+    /**
+     * The target output latency, in seconds: how much audio is queued ahead of playback. Lower
+     * latency makes sounds start sooner, but needs the app to keep the audio system fed more
+     * often. Players can override it with #malPlayerSetTargetLatency(). If 0, the platform default
+     * is used. Currently only used by PulseAudio, where the default is 0.5 seconds per player, or
+     * 0.05 seconds with software mixing.
+     */
+    double targetLatency;
+    /**
+     * If `true`, buffers created with #malBufferCreate() or #malBufferCreateAdpcm() are
+     * deduplicated. If a buffer with the same format and data already exists, that buffer is
+     * retained and returned instead of creating a new one, so memory use scales with the number of
+     * unique sounds rather than the number of loads. The cache doesn't keep buffers alive. The
+     * default is `false`.
+     */
+    bool deduplicateBuffers;
+    /**
+     * If `true`, the gain and mute of players are applied to their audio before it is sent to the
+     * audio system, instead of being set on the audio system's streams. Gain changes take effect at
+     * the next render period, without a round trip to the audio system, and are ramped over the
+     * period to avoid zipper noise, so the gain can be animated every frame. Currently only used by
+     * PulseAudio; ignored on other platforms. With software mixing, gain is always applied by the
+     * mixer. The default is `false`.
+     */
+    bool softwareGain;
+} MalContextConfig;
+
+/**
+ * Memory and object counts of a context. See #malContextGetStats().
+ */
+typedef struct {
+    /**
+     * Bytes of buffer data owned by the library: buffers created with #malBufferCreate() or
+     * #malBufferCreateAdpcm(), and buffers resampled or decoded by the library.
+     */
+    uint64_t copiedBufferBytes;
+    /**
+     * Bytes of buffer data owned by the app, from buffers created with #malBufferCreateNoCopy().
+     */
+    uint64_t noCopyBufferBytes;
+    /**
+     * Bytes of buffer data mapped from files with #malBufferCreateFromFile().
+     */
+    uint64_t mappedBufferBytes;
+    /**
+     * Bytes of the ring buffers of streams created with #malStreamCreate().
+     */
+    uint64_t streamBytes;
+    uint32_t numBuffers;
+    uint32_t numPlayers;
+    uint32_t numStreams;
+    /**
+     * The number of players that finished playing and are waiting for their `onFinished`
+     * callback. Players are retained until their callback is called by #malContextPollEvents().
+     */
+    uint32_t numPendingFinishedCallbacks;
+    /**
+     * The number of streams open in the audio system, including the software mixer's stream and
+     * streams prepared with #malContextPrewarm(). Currently only counted on PulseAudio; 0 on other
+     * platforms.
+     */
+    uint32_t numAudioSystemStreams;
+} MalContextStats;
+
+/**
+ * The number of buckets in the `renderTimeHistogram` of #MalRenderStats.
+ */
+#define MAL_RENDER_TIME_HISTOGRAM_SIZE 10
+
+/**
+ * Underrun and render callback counts of a context or player, for detecting audio glitches. See
+ * #malContextGetRenderStats() and #malPlayerGetRenderStats().
+ */
+typedef struct {
+    /**
+     * The number of times the audio system ran out of audio while playing, which is heard as a
+     * glitch.
+     */
+    uint32_t numUnderruns;
+    /**
+     * The number of render callbacks, where the audio system requested more audio.
+     */
+    uint32_t numRenderCallbacks;
+    /**
+     * The shortest and longest render callback durations, in seconds.
+     */
+    double minRenderTime;
+    double maxRenderTime;
+    /**
+     * The number of render callbacks by duration. The first bucket counts callbacks shorter than
+     * 0.125 milliseconds, each following bucket doubles the limit, and the last bucket counts
+     * callbacks of 32 milliseconds or longer.
+     */
+    uint32_t renderTimeHistogram[MAL_RENDER_TIME_HISTOGRAM_SIZE];
+    /**
+     * The number of bytes the audio system requested, and the number of bytes written, in render
+     * callbacks. Fewer bytes are written than requested when a player has nothing more to play.
+     */
+    uint64_t bytesRequested;
+    uint64_t bytesWritten;
+    /**
+     * The number of bytes copied into the audio system's memory in render callbacks. This is less
+     * than `bytesWritten` when buffer data is passed to the audio system without copying, which
+     * PulseAudio does if mal is built with `MAL_PULSEAUDIO_ZERO_COPY`.
+     */
+    uint64_t bytesCopied;
+} MalRenderStats;
+
 // MARK: Context
 
 /**
@@ -96,6 +283,64 @@ MalContext *malContextCreate(void);
 MalContext *malContextCreateWithOptions(double sampleRate, void *androidActivity,
                                         const char **errorMissingAudioSystem);
 
+/**
+ * Gets a context config with the default values: the default sample rate, no Android activity,
+ * no software mixing, 16 voices, the default latency, no buffer deduplication, and no software
+ * gain.
+ */
+MalContextConfig malContextGetDefaultConfig(void);
+
+/**
+ * Creates an audio context with the specified config. Only one context should be created, and
+ * when finished using the context, it should be released with #malContextRelease().
+ *
+ * @param config The context config. If `NULL`, the default config is used.
+ * @param errorMissingAudioSystem If the `MalContext` could not be created because of a missing
+ * audio system (for example, "PulseAudio" on Linux), this is a pointer to the name of the missing
+ * audio system. May be `NULL`.
+ */
+MalContext *malContextCreateWithConfig(const MalContextConfig *config,
+                                       const char **errorMissingAudioSystem);
+
+/**
+ * Creates an audio context without waiting for the connection to the audio system. The context is
+ * returned immediately, while it is still connecting, so audio startup can overlap with other work
+ * like asset loading.
+ *
+ * Buffers, streams, and players can be created, and players can be started, before the context is
+ * ready. Players are connected to the audio system, and players that were started begin playing,
+ * once the context is ready. Until then, #malContextSetActive() fails, and the context's sample
+ * rate is unknown.
+ *
+ * The context becomes ready during a call to #malContextPollEvents(), which then calls `onReady`.
+ * If the connection failed, `onReady` is called with `success` set to `false`, and the context
+ * should be released.
+ *
+ * Currently only PulseAudio connects asynchronously. If connecting can't be started, `onReady` is
+ * called with `success` set to `false` on the first #malContextPollEvents(). On other platforms,
+ * the context connects before this function returns, and `onReady` is called on the first
+ * #malContextPollEvents().
+ *
+ * @param config The context config. If `NULL`, the default config is used.
+ * @param onReady The function to call when the context is ready, or the connection failed. May be
+ * `NULL`.
+ * @param userData The user data passed to `onReady`.
+ * @param errorMissingAudioSystem If the `MalContext` could not be created because of a missing
+ * audio system (for example, "PulseAudio" on Linux), this is a pointer to the name of the missing
+ * audio system. May be `NULL`.
+ */
+MalContext *malContextCreateAsync(const MalContextConfig *config, malContextReadyFunc onReady,
+                                  void *userData, const char **errorMissingAudioSystem);
+
+/**
+ * Checks if the context is connected to the audio system. Contexts created with
+ * #malContextCreateAsync() become ready during a call to #malContextPollEvents(); other contexts
+ * are always ready.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ */
+bool malContextIsReady(const MalContext *context);
+
 /**
  * Increases the reference count of the context by one.
  *
@@ -115,7 +360,8 @@ void malContextRetain(MalContext *context);
 void malContextRelease(MalContext *context);
 
 /**
- * Gets the output sample rate.
+ * Gets the output sample rate. Returns #MAL_DEFAULT_SAMPLE_RATE while a context created with
+ * #malContextCreateAsync() is connecting.
  */
 double malContextGetSampleRate(const MalContext *context);
 
@@ -130,13 +376,130 @@ double malContextGetSampleRate(const MalContext *context);
 bool malContextSetActive(MalContext *context, bool active);
 
 /**
- * Sends any pending events requested via #malPlayerSetFinishedFunc(). Typically,
+ * Gets the current time of the context's audio clock, in seconds. Use it with
+ * #malPlayerPlayAt() to schedule players to start at an exact time.
+ *
+ * The clock starts at 0 when the context is created, and advances with the audio output. It may
+ * not advance while the context is inactive.
+ *
+ * Currently only supported on PulseAudio and the null audio system. With the null audio system,
+ * the clock is the number of frames rendered with #malContextRender(), in seconds.
+ *
+ * @param context The audio context. If `NULL`, this function returns 0.
+ * @return The current time, or 0 if the audio clock isn't supported.
+ */
+double malContextGetTime(MalContext *context);
+
+/**
+ * Prepares audio system resources for players of the specified format, so that creating the
+ * players later doesn't block while the resources are created. Call it during loading, for the
+ * formats that will be played.
+ *
+ * On PulseAudio, `count` playback streams are connected and kept ready. #malPlayerCreate() takes
+ * a ready stream if one is available, and releasing a player returns its stream, so at most
+ * `count` streams of the format are kept while unused. Unused streams are disconnected when the
+ * context is deactivated.
+ *
+ * Currently only supported on PulseAudio. With software mixing, players don't have their own
+ * streams, so there is nothing to prepare and this function returns `true`.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ * @param format The player format.
+ * @param count The number of players to prepare resources for.
+ * @return `true` if successful. Returns `false` if the format is invalid, the context is
+ * connecting, or the platform doesn't support prewarming.
+ */
+bool malContextPrewarm(MalContext *context, MalFormat format, uint32_t count);
+
+/**
+ * Gets the memory and object counts of the context, for tracking leaks and memory budgets. The
+ * counts are kept as objects are created and freed, so this function is cheap enough to call every
+ * frame.
+ *
+ * @param context The audio context. If `NULL`, all counts are zero.
+ */
+MalContextStats malContextGetStats(const MalContext *context);
+
+/**
+ * Gets the underrun and render callback counts of the context, which include the counts of all its
+ * players. The counts are updated by the audio thread without locks, and can be read from any
+ * thread. Each count is read atomically, but the counts may be from different render callbacks.
+ *
+ * Currently only supported on PulseAudio and the null audio system. With the null audio system,
+ * each call to #malContextRender() is a render callback.
+ *
+ * @param context The audio context. If `NULL`, all counts are zero.
+ */
+MalRenderStats malContextGetRenderStats(const MalContext *context);
+
+/**
+ * Plays a buffer on a player from the context's voice pool. Use it for short sounds that don't
+ * need to be controlled after they start, like sound effects.
+ *
+ * Idle voices are reused. If all voices are in use, the voice with the lowest priority is stopped
+ * and reused; among voices with the same priority, the quietest one is stopped. If every voice
+ * has a higher priority (or the same priority and a higher gain) than the new sound, the new
+ * sound isn't played.
+ *
+ * Voices become idle when they finish, which is detected when #malContextPollEvents() is called.
+ * Voices count toward the platform's limit on the number of players. See
+ * #MalContextConfig::maxVoices.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ * @param buffer The buffer to play. The buffer is retained until the sound finishes.
+ * @param gain The gain, from 0.0 to 1.0.
+ * @param priority The priority of the sound. Higher values are more important.
+ * @return `true` if the sound started playing.
+ */
+bool malContextPlay(MalContext *context, MalBuffer *buffer, float gain, int priority);
+
+/**
+ * Begins a batch of changes. Until #malContextCommitBatch() is called, changes to the gain, mute
+ * state, and playback state of players are collected instead of being sent to the audio system
+ * one at a time. This reduces the locking and server round trips when many players change at
+ * once, for example once per game frame.
+ *
+ * The player and context getters (like #malPlayerGetState()) return the new values immediately.
+ *
+ * Batches may be nested; the changes are applied when the outermost batch is committed.
+ * Currently only PulseAudio (without software mixing) defers changes. Other platforms apply them
+ * immediately.
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ */
+void malContextBeginBatch(MalContext *context);
+
+/**
+ * Commits a batch of changes started with #malContextBeginBatch().
+ *
+ * @param context The audio context. If `NULL`, this function does nothing.
+ */
+void malContextCommitBatch(MalContext *context);
+
+/**
+ * Sends any pending events requested via #malContextCreateAsync(), #malPlayerSetFinishedFunc(),
+ * #malStreamSetLowWatermarkFunc(), and #malStreamSetUnderrunFunc(). Typically,
  * #malContextPollEvents() should be called regularly in the game loop.
  *
  * @param context The audio context. If `NULL`, this function does nothing.
  */
 void malContextPollEvents(MalContext *context);
 
+/**
+ * Gets a file descriptor that becomes readable when #malContextPollEvents() has events to send,
+ * so that an app without a game loop can wait for events with `poll`, `epoll`, or `select`
+ * instead of polling regularly. The descriptor is reset by #malContextPollEvents().
+ *
+ * The descriptor is created on the first call, and is owned by the context. Don't read, write,
+ * or close it.
+ *
+ * This function is only supported on Linux.
+ *
+ * @param context The audio context.
+ * @return The file descriptor, or -1 if not supported or if `context` is `NULL`.
+ */
+int malContextGetEventFd(MalContext *context);
+
 /**
  * Checks if the audio context is muted.
  *
@@ -174,6 +537,10 @@ void malContextSetGain(MalContext *context, float gain);
  * Checks if the context can play audio in the specified format. If this function returns `true`, 
  * and #malPlayerCreate() returns `NULL`, then the maximum number of players has been reached.
  *
+ * All audio systems support 8-bit and 16-bit integer samples, mono or stereo. PulseAudio and the
+ * null audio system also support 24-bit and 32-bit integer samples, 32-bit float samples, and
+ * up to 8 channels.
+ *
  * @param context The audio context. If `NULL`, this function does nothing.
  * @param format The audio format to check.
  * @return `true` if the format can be played by the context.
@@ -190,13 +557,32 @@ bool malContextIsFormatValid(const MalContext *context, MalFormat format);
  */
 bool malContextIsFormatEqual(const MalContext *context, MalFormat format1, MalFormat format2);
 
+/**
+ * Renders audio from every playing player into the provided buffer, advancing the players by
+ * `numFrames`. Rendering is deterministic and not tied to real time.
+ *
+ * Only the null audio system (built with `MAL_USE_NULL_AUDIO`) renders on demand. Other audio
+ * systems render on their own thread, and this function returns `false`.
+ *
+ * @param context The audio context. If `NULL`, this function returns `false`.
+ * @param numFrames The number of frames to render.
+ * @param outBuffer The buffer to render to. The buffer must have room for `numFrames` frames of
+ * interleaved stereo 32-bit float samples at the context's sample rate. Samples are not clipped.
+ * @return `true` if successful.
+ */
+bool malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer);
+
 // MARK: Buffers
 
 /**
  * Creates a new audio buffer from the provided data. The data buffer is copied.
  *
- * The data must be in signed linear PCM format. The byte order must be the same as the native
- * byte order (usually little endian). If stereo, the data must be interleaved.
+ * The data must be in signed linear PCM format, or 32-bit float format if `format.isFloat` is
+ * `true`. The byte order must be the same as the native byte order (usually little endian). If
+ * stereo, the data must be interleaved.
+ *
+ * If the context was created with #MalContextConfig::deduplicateBuffers, and a buffer with the
+ * same format and data exists, that buffer is retained and returned.
  *
  * The buffer should be released with #malBufferRelease().
  *
@@ -214,8 +600,9 @@ MalBuffer *malBufferCreate(MalContext *context, MalFormat format, uint32_t numFr
 /**
  * Creates a new audio buffer from the provided data.
  *
- * The data must be in signed linear PCM format. The byte order must be the same as the native
- * byte order (usually little endian). If stereo, the data must be interleaved.
+ * The data must be in signed linear PCM format, or 32-bit float format if `format.isFloat` is
+ * `true`. The byte order must be the same as the native byte order (usually little endian). If
+ * stereo, the data must be interleaved.
  *
  * If possible, the data is used directly without copying. When the original data is no longer
  * needed, the `dataDeallocator` function is called. If the underlying implementation must copy
@@ -237,6 +624,57 @@ MalBuffer *malBufferCreate(MalContext *context, MalFormat format, uint32_t numFr
 MalBuffer *malBufferCreateNoCopy(MalContext *context, MalFormat format, uint32_t numFrames,
                                  void *data, malDeallocatorFunc dataDeallocator);
 
+/**
+ * Creates a new audio buffer from a WAV file.
+ *
+ * The file is memory-mapped, and if possible, the buffer uses the PCM data in the mapping directly
+ * without copying. Creating the buffer doesn't read the entire file, pages of the file are shared
+ * with other processes that map the same file, and the system may evict pages that haven't been
+ * played recently. The mapping is removed when the buffer is destroyed.
+ *
+ * The file must be linear PCM (8-bit unsigned, or signed 16-bit or higher), 32-bit float, or
+ * ADPCM (see #MalAdpcmEncoding). ADPCM files are decoded during playback where supported (see
+ * #malBufferCreateAdpcm()). The file must not be modified or truncated while the buffer exists.
+ * The data returned from #malBufferGetData() is read-only.
+ *
+ * The buffer should be released with #malBufferRelease().
+ *
+ * @param context The audio context. If `NULL`, this function returns `NULL`.
+ * @param path The path to the WAV file. If `NULL`, this function returns `NULL`.
+ * @return If successful, returns the audio buffer. Returns `NULL` if the file couldn't be opened,
+ * the file isn't a WAV file, the format is invalid, or the file's byte order differs from the
+ * native byte order and the file isn't 8-bit.
+ */
+MalBuffer *malBufferCreateFromFile(MalContext *context, const char *path);
+
+/**
+ * Creates a new audio buffer from ADPCM-encoded data. The data is copied as-is, and is decoded
+ * while the buffer is played, so the buffer uses about a quarter of the memory of a 16-bit PCM
+ * buffer.
+ *
+ * The data is only decoded during playback on PulseAudio and the null audio system. On other
+ * platforms, the data is decoded into a 16-bit PCM buffer when the buffer is created.
+ *
+ * Buffers are deduplicated like #malBufferCreate() if enabled, but only on platforms where the
+ * data is decoded during playback.
+ *
+ * The buffer should be released with #malBufferRelease().
+ *
+ * @param context The audio context. If `NULL`, this function returns `NULL`.
+ * @param format The format of the decoded data. The `bitDepth` must be 16 and `isFloat` must be
+ * `false`.
+ * @param numFrames The number of decoded frames.
+ * @param encoding The ADPCM encoding.
+ * @param blockSize The size of each block, in bytes (the WAV file's "block align" value).
+ * @param data The ADPCM blocks. The data must have a byte length of `blockSize` times the number
+ * of blocks needed for `numFrames` frames.
+ * @return If successful, returns the audio buffer. Returns `NULL` if the format is invalid,
+ * `numFrames` is zero, `blockSize` is invalid for the encoding and number of channels, `data` is
+ * `NULL`, or an out-of-memory error occurs.
+ */
+MalBuffer *malBufferCreateAdpcm(MalContext *context, MalFormat format, uint32_t numFrames,
+                                MalAdpcmEncoding encoding, uint32_t blockSize, const void *data);
+
 /**
  * Increases the reference count of the buffer by one.
  *
@@ -276,17 +714,165 @@ uint32_t malBufferGetNumFrames(const MalBuffer *buffer);
  *
  * @param buffer The audio buffer. If `NULL`, the returns `NULL`.
  * @return The pointer to the buffer's underlying data, or `NULL` if the buffer was created with
- * #malBufferCreate() or if the underlying implementation must copy buffers.
+ * #malBufferCreate() or #malBufferCreateAdpcm(), or if the underlying implementation must copy
+ * buffers.
  */
 void *malBufferGetData(const MalBuffer *buffer);
 
+/**
+ * Creates a new audio buffer by resampling an existing buffer to a different sample rate. The
+ * new buffer has the same bit depth and number of channels as the original. If the original is
+ * an ADPCM buffer, the new buffer is 16-bit PCM.
+ *
+ * Resampling is done once, with a polyphase windowed-sinc filter, so buffers recorded at different
+ * sample rates (for example, 22050 and 44100) can share players created for one sample rate
+ * (typically the context's sample rate), and no resampling is needed during playback.
+ *
+ * Frames before the start and after the end of the original buffer are treated as silence.
+ *
+ * The buffer should be released with #malBufferRelease().
+ *
+ * @param buffer The audio buffer to resample. If `NULL`, this function returns `NULL`.
+ * @param sampleRate The sample rate of the new buffer. Use #MAL_DEFAULT_SAMPLE_RATE to use the
+ * context's sample rate.
+ * @param quality The resampler quality.
+ * @return If successful, returns the new audio buffer. If the buffer already has the requested
+ * sample rate, the buffer is retained and returned. Returns `NULL` if the buffer was created with
+ * #malBufferCreateNoCopy() on a platform that copies buffers (see #malBufferGetData()), or if an
+ * out-of-memory error occurs.
+ */
+MalBuffer *malBufferCreateResampled(MalBuffer *buffer, double sampleRate,
+                                    MalResampleQuality quality);
+
+// MARK: Streams
+
+/**
+ * Creates a new audio stream. A stream is a fixed-size ring buffer: a producer thread writes audio
+ * data with #malStreamWrite(), and the player the stream is attached to consumes it. Only the
+ * frames waiting to be played are held in memory, so long audio (like music) doesn't need to be
+ * fully decoded into memory.
+ *
+ * Only one thread may write to the stream at a time. The audio thread never blocks on the stream.
+ *
+ * Streams are only supported on PulseAudio and the null audio system. On other platforms,
+ * #malPlayerSetStream() fails.
+ *
+ * The stream should be released with #malStreamRelease().
+ *
+ * @param context The audio context. If `NULL`, this function returns `NULL`.
+ * @param format The format of the data that will be written to the stream.
+ * @param numFrames The capacity of the stream, in frames. The capacity is rounded up to the next
+ * power of two. A few hundred milliseconds is typical.
+ * @return If successful, returns the audio stream. Returns `NULL` if the format is invalid,
+ * `numFrames` is zero, or an out-of-memory error occurs.
+ */
+MalStream *malStreamCreate(MalContext *context, MalFormat format, uint32_t numFrames);
+
+/**
+ * Increases the reference count of the stream by one.
+ *
+ * @param stream The audio stream. If `NULL`, this function returns nothing.
+ */
+void malStreamRetain(MalStream *stream);
+
+/**
+ * Decreases the reference count of the stream by one. When the reference count is zero, the
+ * stream is destroyed.
+ *
+ * @param stream The audio stream. If `NULL`, this function returns nothing.
+ */
+void malStreamRelease(MalStream *stream);
+
+/**
+ * Gets the format of the stream.
+ *
+ * @param stream The audio stream. If `NULL`, the returned format will have a sample rate of 0.
+ * @return The audio format of the stream.
+ */
+MalFormat malStreamGetFormat(const MalStream *stream);
+
+/**
+ * Gets the capacity of the stream, in frames.
+ *
+ * @param stream The audio stream. If `NULL`, the returned value is 0.
+ */
+uint32_t malStreamGetCapacity(const MalStream *stream);
+
+/**
+ * Gets the number of frames written to the stream that haven't been played yet. May be called
+ * from any thread.
+ *
+ * @param stream The audio stream. If `NULL`, the returned value is 0.
+ */
+uint32_t malStreamGetNumQueuedFrames(const MalStream *stream);
+
+/**
+ * Writes frames to the stream. Writes as many frames as fit, without blocking.
+ *
+ * The data must be in the stream's format, with the same byte order as the native CPU. If stereo,
+ * the data must be interleaved.
+ *
+ * @param stream The audio stream. If `NULL`, this function returns 0.
+ * @param data The data to write.
+ * @param numFrames The number of frames in `data`.
+ * @return The number of frames written. Returns 0 if the stream is full or has ended.
+ */
+uint32_t malStreamWrite(MalStream *stream, const void *data, uint32_t numFrames);
+
+/**
+ * Marks the end of the stream. No more frames may be written. When the queued frames have been
+ * played, the player stops, and its finished function (see #malPlayerSetFinishedFunc()) is
+ * called.
+ *
+ * @param stream The audio stream. If `NULL`, this function does nothing.
+ */
+void malStreamEnd(MalStream *stream);
+
+/**
+ * Checks if #malStreamEnd() was called.
+ *
+ * @param stream The audio stream. If `NULL`, this function returns `false`.
+ */
+bool malStreamIsEnded(const MalStream *stream);
+
+/**
+ * Sets the function to call when the number of queued frames drops to `numFrames` or below while
+ * playing. Use it to wake the producer thread. The function is invoked from
+ * #malContextPollEvents(). It may be called again on a later poll if the stream is still below
+ * the watermark.
+ *
+ * @param stream The audio stream. If `NULL`, this function does nothing.
+ * @param numFrames The low watermark, in frames.
+ * @param onLowWatermark The callback function, or `NULL`.
+ * @param userData The user data to pass to the callback function. May be `NULL`.
+ */
+void malStreamSetLowWatermarkFunc(MalStream *stream, uint32_t numFrames,
+                                  malStreamFunc onLowWatermark, void *userData);
+
+/**
+ * Sets the function to call when the stream underruns: the player ran out of frames while playing
+ * and the stream wasn't ended. The function is invoked from #malContextPollEvents().
+ *
+ * @param stream The audio stream. If `NULL`, this function does nothing.
+ * @param onUnderrun The callback function, or `NULL`.
+ * @param userData The user data to pass to the callback function. May be `NULL`.
+ */
+void malStreamSetUnderrunFunc(MalStream *stream, malStreamFunc onUnderrun, void *userData);
+
+/**
+ * Gets the number of times the stream has underrun since it was created.
+ *
+ * @param stream The audio stream. If `NULL`, the returned value is 0.
+ */
+uint32_t malStreamGetUnderrunCount(const MalStream *stream);
+
 // MARK: Players
 
 /**
  * Creates a new player with the specified format.
  *
  * Usually only a limited number of players may be created, depending on the implementation.
- * Typically 16 or 32.
+ * Typically 16 or 32. If the context uses software mixing, there is no fixed limit.
  *
  * The player should be released with #malPlayerRelease().
  *
@@ -342,6 +928,31 @@ bool malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer);
  */
 MalBuffer *malPlayerGetBuffer(const MalPlayer *player);
 
+/**
+ * Attaches a stream to the player. The player plays the stream's frames as they are written.
+ * Attaching a stream detaches the player's buffer (if any), and attaching a buffer detaches the
+ * player's stream.
+ *
+ * A stream should only be attached to one player at a time. The player's looping state is
+ * ignored. Stopping the player doesn't discard the frames queued in the stream.
+ *
+ * When a stream is attached to a player, it is retained, and the previous stream (if any) is
+ * released.
+ *
+ * @param player The audio player. If `NULL`, this function does nothing.
+ * @param stream The audio stream. May be `NULL`.
+ * @return `true` if successful. Returns `false` if the platform doesn't support streams.
+ */
+bool malPlayerSetStream(MalPlayer *player, MalStream *stream);
+
+/**
+ * Gets the stream attached to the player.
+ *
+ * @param player The audio player. If `NULL`, this function returns `NULL`.
+ * @return The stream attached to the player, or `NULL` if no stream is currently attached.
+ */
+MalStream *malPlayerGetStream(const MalPlayer *player);
+
 /**
  * Sets the function to call when a player has finished playing. The function is not called when
  * the player is forced to stop, for example when calling #malPlayerSetState() with the 
@@ -391,13 +1002,35 @@ void malPlayerSetMute(MalPlayer *player, bool mute);
 float malPlayerGetGain(const MalPlayer *player);
 
 /**
- * Sets the gain (volume) for the player.
+ * Sets the gain (volume) for the player. Cancels the player's fade, if any.
  *
  * @param player The player. If `NULL`, this function does nothing.
  * @param gain The gain, from 0.0 to 1.0.
  */
 void malPlayerSetGain(MalPlayer *player, float gain);
 
+/**
+ * Fades the gain (volume) of the player to `gain`, linearly over `duration` seconds. The fade is
+ * evaluated on the audio thread, so it's smooth regardless of how often the app's main loop runs.
+ * The fade starts at the player's current gain, which may be part-way through another fade.
+ *
+ * The fade progresses only while the player is playing. After this call, #malPlayerGetGain()
+ * returns `gain`. Calling #malPlayerSetGain() or this function again replaces the fade.
+ *
+ * On PulseAudio without software mixing or software gain, the first fade of a player moves its
+ * gain from the server to the player's render callback (as with `softwareGain` in
+ * #MalContextConfig). The change may be heard as a short jump in volume when that first fade
+ * starts.
+ *
+ * @param player The player. If `NULL`, this function returns `false`.
+ * @param gain The gain at the end of the fade, from 0.0 to 1.0.
+ * @param duration The duration of the fade, in seconds.
+ * @param stopWhenFaded If `true`, the player stops when the fade ends, and the finished callback
+ * (see #malPlayerSetFinishedFunc()) is called as if playback had ended.
+ * @return `true` if successful.
+ */
+bool malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded);
+
 /**
  * Gets the looping state for the player.
  *
@@ -418,6 +1051,50 @@ bool malPlayerIsLooping(const MalPlayer *player);
  */
 bool malPlayerSetLooping(MalPlayer *player, bool looping);
 
+/**
+ * Sets the target output latency of the player, overriding the context's target latency (see
+ * #MalContextConfig). For example, short sound effects can use a low latency, while music uses a
+ * high latency.
+ *
+ * Currently only supported on PulseAudio without software mixing.
+ *
+ * @param player The player. If `NULL`, this function does nothing.
+ * @param latency The target latency, in seconds. If 0, the context's target latency is used.
+ * @return `true` if successful.
+ */
+bool malPlayerSetTargetLatency(MalPlayer *player, double latency);
+
+/**
+ * Gets the target output latency of the player set with #malPlayerSetTargetLatency().
+ *
+ * @param player The player. If `NULL`, this function returns 0.
+ * @return The target latency, in seconds, or 0 if the context's target latency is used.
+ */
+double malPlayerGetTargetLatency(const MalPlayer *player);
+
+/**
+ * Gets the measured output latency of the player: the time from when audio is queued until it is
+ * heard. The audio system may not be able to honor the target latency exactly.
+ *
+ * Currently only supported on PulseAudio. With software mixing, this is the latency of the
+ * context's mixed output.
+ *
+ * @param player The player. If `NULL`, this function returns 0.
+ * @return The latency, in seconds, or 0 if it isn't known yet or isn't supported.
+ */
+double malPlayerGetLatency(MalPlayer *player);
+
+/**
+ * Gets the underrun and render callback counts of the player. See #malContextGetRenderStats().
+ *
+ * Render callbacks are only counted for players with their own audio system stream. With software
+ * mixing, or with the null audio system, the player's underruns are counted, and its render
+ * callbacks are counted in the context's stats.
+ *
+ * @param player The player. If `NULL`, all counts are zero.
+ */
+MalRenderStats malPlayerGetRenderStats(const MalPlayer *player);
+
 /**
  * Gets the state of the player.
  *
@@ -427,8 +1104,8 @@ bool malPlayerSetLooping(MalPlayer *player, bool looping);
 MalPlayerState malPlayerGetState(MalPlayer *player);
 
 /**
- * Sets the state of the player. If a buffer is attached to the player, this function can be
- * used to play or stop the player.
+ * Sets the state of the player. If a buffer or stream is attached to the player, this function can
+ * be used to play or stop the player.
  * 
  * @param player The audio player. If `NULL`, this function does nothing.
  * @param state The player state.
@@ -436,6 +1113,60 @@ MalPlayerState malPlayerGetState(MalPlayer *player);
  */
 bool malPlayerSetState(MalPlayer *player, MalPlayerState state);
 
+/**
+ * Plays the player from the beginning, starting at the specified time of the context's audio
+ * clock (see #malContextGetTime()). If the player is playing, it is restarted. If the time has
+ * already passed, the player starts immediately.
+ *
+ * Players scheduled for the same time start on the same frame when the context uses software
+ * mixing (and with the null audio system). Otherwise, each player's start is aligned using the
+ * audio system's latency estimate.
+ *
+ * @param player The audio player. If `NULL`, this function does nothing.
+ * @param time The time to start playing, in seconds.
+ * @return `true` if successful. Returns `false` if no buffer or stream is attached, or if the
+ * platform doesn't support scheduled starts.
+ */
+bool malPlayerPlayAt(MalPlayer *player, double time);
+
+// MARK: Tracing
+
+/**
+ * Begins a trace span on the current thread. Use it to add the app's own spans, like game frames,
+ * to the trace, so they can be lined up with the audio system's spans.
+ *
+ * Spans are only recorded if the library is built with `MAL_TRACE` defined (the `MAL_TRACE` CMake
+ * option). Otherwise, this function does nothing. Each thread records up to 65536 begin and end
+ * events, without locks.
+ *
+ * Spans are recorded on the first 32 threads that begin or end a span, including the audio
+ * system's threads. A thread's events (about 1.5 MB) are kept until the process exits, even after
+ * the thread exits, and spans on later threads are not recorded. The limits can be changed by
+ * defining `MAL_TRACE_MAX_THREADS` and `MAL_TRACE_MAX_EVENTS` when building the library.
+ *
+ * @param name The span name. The string isn't copied, so it should be a string literal or
+ * otherwise outlive the trace. If `NULL`, this function does nothing.
+ */
+void malTraceBegin(const char *name);
+
+/**
+ * Ends the trace span on the current thread that was begun with #malTraceBegin().
+ *
+ * @param name The span name. If `NULL`, this function does nothing.
+ */
+void malTraceEnd(const char *name);
+
+/**
+ * Writes the trace spans recorded so far, on all threads, to a file in the Chrome trace event
+ * format. The file can be opened in `chrome://tracing` or Perfetto. Times are in microseconds of a
+ * monotonic clock. Can be called from any thread.
+ *
+ * @param path The file path.
+ * @return `true` if successful. Returns `false` if the library was built without `MAL_TRACE`, or
+ * if the file couldn't be written.
+ */
+bool malTraceWriteFile(const char *path);
+
 #ifdef __cplusplus
 }
 #endif
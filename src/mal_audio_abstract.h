@@ -26,6 +26,29 @@
 #include "ok_lib.h"
 #include <math.h>
 
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#  include <sys/eventfd.h>
+#  define MAL_HAS_EVENT_FD
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define MAL_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define MAL_SIMD_NEON
+#endif
+
 // MARK: Atomics
 
 #if defined(OK_LIB_USE_STDATOMIC)
@@ -49,6 +72,18 @@
 #  error stdatomic.h required
 #endif
 
+// Trace spans, recorded only if MAL_TRACE is defined. See malTraceWriteFile().
+
+#if defined(MAL_TRACE)
+#  include <stdio.h>
+#  define MAL_TRACE_BEGIN(name) _malTraceAdd((name), 'B')
+#  define MAL_TRACE_END(name) _malTraceAdd((name), 'E')
+static void _malTraceAdd(const char *name, char phase);
+#else
+#  define MAL_TRACE_BEGIN(name) do { } while (0)
+#  define MAL_TRACE_END(name) do { } while (0)
+#endif
+
 // Audio subsystems need to implement these structs and functions.
 // All functions that return a `bool` should return `true` on success, `false` otherwise.
 
@@ -58,6 +93,13 @@ struct _MalPlayer;
 
 static bool _malContextInit(MalContext *context, void *androidActivity,
                             const char **errorMissingAudioSystem);
+#ifdef MAL_CONNECTS_ASYNC
+// Starts connecting without waiting. When finished, the implementation calls
+// _malContextSetConnectResult() from any thread. Only implemented by audio systems that define
+// MAL_CONNECTS_ASYNC; others connect synchronously in malContextCreateAsync().
+static bool _malContextInitAsync(MalContext *context, void *androidActivity,
+                                 const char **errorMissingAudioSystem);
+#endif
 static void _malContextDidCreate(MalContext *context);
 static void _malContextWillDispose(MalContext *context);
 static void _malContextDispose(MalContext *context);
@@ -65,10 +107,22 @@ static void _malContextDidSetActive(MalContext *context, bool active);
 static bool _malContextSetActive(MalContext *context, bool active);
 static void _malContextUpdateMute(MalContext *context);
 static void _malContextUpdateGain(MalContext *context);
+static bool _malContextIsFormatValid(const MalContext *context, MalFormat format);
+static bool _malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer);
+static bool _malContextGetTime(MalContext *context, double *time);
+static void _malContextCommitBatch(MalContext *context);
+// Called at the end of malContextPollEvents(), on the app thread.
+static void _malContextPollEvents(MalContext *context);
+static bool _malContextPrewarm(MalContext *context, MalFormat format, uint32_t count);
+// Returns the number of streams (or voices) open in the audio system. Only called on the app
+// thread.
+static uint32_t _malContextGetNumAudioSystemStreams(const MalContext *context);
 /**
  Either `copiedData` or `managedData` will be non-null, but not both. If `copiedData` is set,
  the data must be copied (don't keep a reference to `copiedData`).
  If successful, the buffer's #managedData and #managedDataDeallocator fields must be set.
+ ADPCM buffers are only passed to audio systems that define `MAL_RENDERS_ADPCM_BUFFERS`; the data
+ length is `_malBufferGetDataLength()`.
  */
 static bool _malBufferInit(MalContext *context, MalBuffer *buffer,
                            const void *copiedData, void *managedData,
@@ -78,15 +132,26 @@ static void _malBufferDispose(MalBuffer *buffer);
 static bool _malPlayerInit(MalPlayer *player, MalFormat format);
 static void _malPlayerDispose(MalPlayer *player);
 static bool _malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer);
+static bool _malPlayerSetStream(MalPlayer *player, MalStream *stream);
 static void _malPlayerUpdateMute(MalPlayer *player);
 static void _malPlayerUpdateGain(MalPlayer *player);
 static bool _malPlayerSetLooping(MalPlayer *player, bool looping);
 static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state);
+/**
+ Sets the player's `startFrame` and starts playing. When the player leaves the
+ `MAL_STREAM_STARTING` state, its first frame should be output at `startFrame` of the context's
+ audio clock (or immediately, if that frame has passed).
+ */
+static bool _malPlayerPlayAt(MalPlayer *player, uint64_t startFrame);
+static bool _malPlayerSetTargetLatency(MalPlayer *player, double latency);
+static bool _malPlayerGetLatency(MalPlayer *player, double *latency);
+static bool _malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded);
 
 // MARK: Globals
 
 typedef struct ok_vec_of(MalPlayer *) MalPlayerVec;
 typedef struct ok_vec_of(MalBuffer *) MalBufferVec;
+typedef struct ok_vec_of(MalStream *) MalStreamVec;
 
 // MARK: Structs
 
@@ -96,6 +161,20 @@ typedef struct ok_vec_of(MalBuffer *) MalBufferVec;
 #  define MAL_STREAM_STATE_TYPE
 #endif
 
+enum {
+    MAL_CONTEXT_CONNECTING = 0,
+    MAL_CONTEXT_CONNECTED,
+    MAL_CONTEXT_CONNECT_FAILED,
+};
+
+// Who owns a buffer's data, for malContextGetStats
+typedef enum {
+    MAL_BUFFER_DATA_COPIED = 0,
+    MAL_BUFFER_DATA_NO_COPY,
+    MAL_BUFFER_DATA_MAPPED,
+    MAL_BUFFER_DATA_KIND_COUNT
+} MalBufferDataKind;
+
 typedef enum MAL_STREAM_STATE_TYPE {
     MAL_STREAM_STOPPED = 0,
     MAL_STREAM_STARTING,
@@ -107,18 +186,113 @@ typedef enum MAL_STREAM_STATE_TYPE {
     MAL_STREAM_DRAINING,
 } MalStreamState;
 
+#ifdef MAL_INCLUDE_MIXER_FUNCTIONS
+
+// Software mixer state of a player. Only accessed on the render thread.
+struct MalMixerVoice {
+    uint32_t nextFrame;
+    uint32_t nextFrameFraction;
+    bool streamStarved;
+};
+
+#endif
+
+/**
+ A fade of a player's gain (see malPlayerFadeTo). Fades are posted on the app thread and evaluated
+ on the render thread. Setting the gain posts a fade with a zero duration.
+ */
+struct MalFade {
+    // The posted fade. `serial` is odd while the fade is being written.
+    _Atomic(uint32_t) serial;
+    _Atomic(float) postedGain;
+    _Atomic(float) postedDuration;
+    _Atomic(bool) postedStopWhenFaded;
+    // The serial and gain of the last zero-duration post (a gain set), so that a fade posted
+    // right after it starts from the set gain even if the render thread never received the set.
+    _Atomic(uint32_t) postedSetSerial;
+    _Atomic(float) postedSetGain;
+
+    // Only accessed on the render thread
+    uint32_t renderSerial;
+    float gain;
+    float targetGain;
+    float gainStep;
+    uint32_t remainingFrames;
+    bool stopWhenFaded;
+    bool jumpToGain;
+};
+
+// Underrun and render callback counts (see MalRenderStats). Only written on the render thread.
+struct MalRenderCounters {
+    _Atomic(uint32_t) numUnderruns;
+    _Atomic(uint32_t) numCallbacks;
+    _Atomic(uint32_t) minCallbackMicros;
+    _Atomic(uint32_t) maxCallbackMicros;
+    _Atomic(uint32_t) callbackHistogram[MAL_RENDER_TIME_HISTOGRAM_SIZE];
+    _Atomic(uint64_t) bytesRequested;
+    _Atomic(uint64_t) bytesWritten;
+    _Atomic(uint64_t) bytesCopied;
+};
+
+struct MalVoiceList {
+    MalFormat format;
+    MalPlayerVec players;
+};
+
+struct MalVoicePool {
+    uint32_t maxVoices;
+    uint32_t numVoices;
+    // A min-heap, ordered by priority, then gain. The first voice is the next one to steal.
+    MalPlayerVec activeVoices;
+    // Idle voices, grouped by format
+    struct ok_vec_of(struct MalVoiceList) idleVoices;
+};
+
 struct MalContext {
     MalPlayerVec players;
     MalBufferVec buffers;
+    MalStreamVec streams;
     float gain;
     bool mute;
     bool active;
+    bool softwareMixing;
+    bool softwareGain;
+    uint32_t batchDepth;
     double requestedSampleRate;
     double actualSampleRate;
+    double targetLatency;
 
     _Atomic(size_t) refCount;
 
+    // Asynchronous connection. While `connecting`, players are created without a connection to
+    // the audio system.
+    bool connecting;
+    bool readyEventPending;
+    _Atomic(int) connectResult;
+    malContextReadyFunc onReady;
+    void *onReadyUserData;
+
     struct ok_queue_of(MalPlayer *) finishedPlayersWithCallbacks;
+    _Atomic(size_t) numFinishedPlayersWithCallbacks;
+    struct ok_queue_of(MalStream *) streamsWithEvents;
+
+    // Readable while events are pending, or -1 until malContextGetEventFd() is called.
+    // `eventSignaled` is set when the descriptor is written, so that the audio thread writes it at
+    // most once per poll.
+    _Atomic(int) eventFd;
+    _Atomic(bool) eventSignaled;
+
+    struct MalVoicePool voicePool;
+
+    // Buffers created from copied data, keyed by a hash of their format and data. The map doesn't
+    // retain the buffers; they are removed when freed. If deduplication is disabled, `m` is NULL.
+    struct ok_map_of(uint64_t, MalBuffer *) bufferCache;
+
+    // Counts of all render callbacks, and of all underruns of the context and its players
+    struct MalRenderCounters renderCounters;
+
+    // Bytes of buffer data, by MalBufferDataKind. Only accessed on the app thread.
+    uint64_t bufferDataBytes[MAL_BUFFER_DATA_KIND_COUNT];
 
     struct _MalContext data;
 };
@@ -130,16 +304,85 @@ struct MalBuffer {
     void *managedData;
     malDeallocatorFunc managedDataDeallocator;
 
+    // Set if #managedData points into a memory-mapped file (see malBufferCreateFromFile)
+    void *mappedFile;
+    size_t mappedFileLength;
+
+    // Set if #managedData is ADPCM blocks (see malBufferCreateAdpcm). Zero for PCM buffers.
+    uint32_t adpcmBlockSize;
+    uint32_t adpcmBlockFrames;
+    MalAdpcmEncoding adpcmEncoding;
+
+    // Set if the buffer is in the context's `bufferCache`
+    bool cached;
+    uint64_t contentHash;
+
+    // Counted in the context's `bufferDataBytes`
+    MalBufferDataKind dataKind;
+    size_t dataLength;
+
     _Atomic(size_t) refCount;
 
     struct _MalBuffer data;
 };
 
+#define MAL_MAX_CHANNELS 8
+#define MAL_ADPCM_MAX_CHANNELS 2
+
+struct MalAdpcmChannel {
+    int32_t sample1; // For IMA, the predictor
+    int32_t sample2;
+    int32_t coef1;
+    int32_t coef2;
+    int32_t delta; // For IMA, the step index
+};
+
+// Decodes an ADPCM buffer one frame at a time. Keeps the previous frame for interpolation.
+struct MalAdpcmDecoder {
+    const MalBuffer *buffer; // If NULL, nothing is decoded yet
+    uint32_t frame;
+    bool hasPrevSamples;
+    int16_t samples[MAL_ADPCM_MAX_CHANNELS];
+    int16_t prevSamples[MAL_ADPCM_MAX_CHANNELS];
+    struct MalAdpcmChannel channels[MAL_ADPCM_MAX_CHANNELS];
+};
+
+struct MalStream {
+    MalContext *context;
+    MalFormat format;
+    uint32_t numFrames; // Power of two
+    uint32_t frameSize;
+    uint8_t *data;
+
+    // Single-producer, single-consumer ring positions, in frames. The positions wrap around at
+    // UINT32_MAX; the ring index is `position & (numFrames - 1)`.
+    _Atomic(uint32_t) readPosition;
+    _Atomic(uint32_t) writePosition;
+    _Atomic(bool) ended;
+    _Atomic(uint32_t) underrunCount;
+
+    _Atomic(size_t) refCount;
+
+    _Atomic(uint32_t) lowWatermark;
+    malStreamFunc onLowWatermark;
+    void *onLowWatermarkUserData;
+    _Atomic(bool) hasLowWatermarkCallback;
+    _Atomic(bool) lowWatermarkEventPending;
+
+    malStreamFunc onUnderrun;
+    void *onUnderrunUserData;
+    _Atomic(bool) hasUnderrunCallback;
+    _Atomic(bool) underrunEventPending;
+};
+
 struct MalPlayer {
     MalContext *context;
     MalFormat format;
     MalBuffer *buffer;
+    MalStream *stream;
     _Atomic(MalStreamState) streamState;
+    uint64_t startFrame; // In frames of the context's audio clock. Read when starting.
+    double targetLatency;
     float gain;
     bool mute;
     _Atomic(bool) looping;
@@ -150,6 +393,22 @@ struct MalPlayer {
     void *onFinishedUserData;
     _Atomic(bool) hasOnFinishedCallback;
 
+    // Voice pool state. `voiceIndex` is the index in the pool's `activeVoices`.
+    bool voiceActive;
+    int voicePriority;
+    size_t voiceIndex;
+
+#ifdef MAL_INCLUDE_MIXER_FUNCTIONS
+    struct MalMixerVoice voice;
+#endif
+
+    // Only accessed on the render thread. Reset when playback starts.
+    struct MalAdpcmDecoder adpcmDecoder;
+
+    struct MalFade fade;
+
+    struct MalRenderCounters renderCounters;
+
     struct _MalPlayer data;
 };
 
@@ -176,46 +435,192 @@ static double _malGetClosestSampleRate(double sampleRate) {
 // MARK: Context
 
 MalContext *malContextCreate() {
-    return malContextCreateWithOptions(MAL_DEFAULT_SAMPLE_RATE, NULL, NULL);
+    return malContextCreateWithConfig(NULL, NULL);
 }
 
 MalContext *malContextCreateWithOptions(double requestedSampleRate, void *androidActivity,
                                         const char **errorMissingAudioSystem) {
+    MalContextConfig config = malContextGetDefaultConfig();
+    config.sampleRate = requestedSampleRate;
+    config.androidActivity = androidActivity;
+    return malContextCreateWithConfig(&config, errorMissingAudioSystem);
+}
+
+MalContextConfig malContextGetDefaultConfig() {
+    MalContextConfig config;
+    memset(&config, 0, sizeof(config));
+    config.sampleRate = MAL_DEFAULT_SAMPLE_RATE;
+    config.androidActivity = NULL;
+    config.softwareMixing = false;
+    config.maxVoices = 16;
+    config.targetLatency = 0.0;
+    config.deduplicateBuffers = false;
+    config.softwareGain = false;
+    return config;
+}
 
+static MalContext *_malContextAlloc(const MalContextConfig *config) {
     MalContext *context = (MalContext *)calloc(1, sizeof(MalContext));
     if (context) {
         atomic_store(&context->refCount, 1);
         context->mute = false;
         context->gain = 1.0f;
-        context->requestedSampleRate = requestedSampleRate;
+        context->softwareMixing = config->softwareMixing;
+        context->softwareGain = config->softwareGain;
+        context->requestedSampleRate = config->sampleRate;
+        context->targetLatency = config->targetLatency;
         ok_vec_init(&context->players);
         ok_vec_init(&context->buffers);
+        ok_vec_init(&context->streams);
         ok_queue_init(&context->finishedPlayersWithCallbacks);
-        bool success = _malContextInit(context, androidActivity, errorMissingAudioSystem);
+        ok_queue_init(&context->streamsWithEvents);
+        atomic_store(&context->eventFd, -1);
+        context->voicePool.maxVoices = config->maxVoices;
+        ok_vec_init(&context->voicePool.activeVoices);
+        ok_vec_init(&context->voicePool.idleVoices);
+        if (config->deduplicateBuffers) {
+            // If this fails, buffers aren't deduplicated
+            ok_map_init_custom(&context->bufferCache, ok_uint64_hash, ok_64bit_equals);
+        }
+    }
+    return context;
+}
+
+// Called once the context is connected to the audio system
+static bool _malContextActivate(MalContext *context) {
+    _malContextDidCreate(context);
+    bool success = malContextSetActive(context, true);
+    if (context->actualSampleRate <= MAL_DEFAULT_SAMPLE_RATE) {
+        context->actualSampleRate = 44100;
+    }
+    return success;
+}
+
+MalContext *malContextCreateWithConfig(const MalContextConfig *config,
+                                       const char **errorMissingAudioSystem) {
+    MalContextConfig defaultConfig = malContextGetDefaultConfig();
+    if (!config) {
+        config = &defaultConfig;
+    }
+
+    MalContext *context = _malContextAlloc(config);
+    if (context) {
+        bool success = (_malContextInit(context, config->androidActivity,
+                                        errorMissingAudioSystem) &&
+                        _malContextActivate(context));
         if (success) {
-            _malContextDidCreate(context);
-            success = malContextSetActive(context, true);
-            if (context->actualSampleRate <= MAL_DEFAULT_SAMPLE_RATE) {
-                context->actualSampleRate = 44100;
-            }
-            if (!success) {
+            atomic_store(&context->connectResult, MAL_CONTEXT_CONNECTED);
+        } else {
+            malContextRelease(context);
+            context = NULL;
+        }
+    }
+    return context;
+}
+
+MalContext *malContextCreateAsync(const MalContextConfig *config, malContextReadyFunc onReady,
+                                  void *userData, const char **errorMissingAudioSystem) {
+    MalContextConfig defaultConfig = malContextGetDefaultConfig();
+    if (!config) {
+        config = &defaultConfig;
+    }
+
+    MalContext *context = _malContextAlloc(config);
+    if (context) {
+        context->onReady = onReady;
+        context->onReadyUserData = userData;
+        context->readyEventPending = true;
+        context->connecting = true;
+        atomic_store(&context->connectResult, MAL_CONTEXT_CONNECTING);
+#ifdef MAL_CONNECTS_ASYNC
+        const char *missingAudioSystem = NULL;
+        if (!_malContextInitAsync(context, config->androidActivity, &missingAudioSystem)) {
+            if (missingAudioSystem) {
+                if (errorMissingAudioSystem) {
+                    *errorMissingAudioSystem = missingAudioSystem;
+                }
                 malContextRelease(context);
-                context = NULL;
+                return NULL;
             }
+            // Reported to `onReady` on the next malContextPollEvents()
+            atomic_store(&context->connectResult, MAL_CONTEXT_CONNECT_FAILED);
+        }
+#else
+        // Connect synchronously
+        context->connecting = false;
+        bool success = (_malContextInit(context, config->androidActivity,
+                                        errorMissingAudioSystem) &&
+                        _malContextActivate(context));
+        if (success) {
+            atomic_store(&context->connectResult, MAL_CONTEXT_CONNECTED);
         } else {
             malContextRelease(context);
             context = NULL;
         }
+#endif
     }
     return context;
 }
 
+// Wakes up the app if it's waiting on the event descriptor. Called from any thread, after the
+// event is queued.
+static void _malContextSignalEvent(MalContext *context) {
+#if defined(MAL_HAS_EVENT_FD)
+    const int eventFd = atomic_load(&context->eventFd);
+    bool signaled = false;
+    if (eventFd >= 0 && atomic_compare_exchange_strong(&context->eventSignaled, &signaled, true)) {
+        const uint64_t value = 1;
+        ssize_t result = write(eventFd, &value, sizeof(value));
+        (void)result;
+    }
+#else
+    (void)context;
+#endif
+}
+
+// Resets the event descriptor. Called from malContextPollEvents(), before the queues are read.
+// The descriptor is read even if `eventSignaled` is clear, because a write may have been in
+// progress when it was last cleared.
+static void _malContextClearEvent(MalContext *context) {
+#if defined(MAL_HAS_EVENT_FD)
+    const int eventFd = atomic_load(&context->eventFd);
+    if (eventFd >= 0) {
+        atomic_store(&context->eventSignaled, false);
+        uint64_t value;
+        ssize_t result = read(eventFd, &value, sizeof(value));
+        (void)result;
+    }
+#else
+    (void)context;
+#endif
+}
+
+#ifdef MAL_CONNECTS_ASYNC
+
+// Called by the implementation, from any thread, when an asynchronous connection finishes
+static void _malContextSetConnectResult(MalContext *context, bool success) {
+    atomic_store(&context->connectResult,
+                 success ? MAL_CONTEXT_CONNECTED : MAL_CONTEXT_CONNECT_FAILED);
+    _malContextSignalEvent(context);
+}
+
+#endif
+
+bool malContextIsReady(const MalContext *context) {
+    return (context && !context->connecting &&
+            atomic_load(&context->connectResult) == MAL_CONTEXT_CONNECTED);
+}
+
 double malContextGetSampleRate(const MalContext *context) {
+    if (context && context->connecting) {
+        // Unknown until connected
+        return MAL_DEFAULT_SAMPLE_RATE;
+    }
     return context ? context->actualSampleRate : 44100;
 }
 
 bool malContextSetActive(MalContext *context, bool active) {
-    if (!context) {
+    if (!context || context->connecting) {
         return false;
     }
     bool success = _malContextSetActive(context, active);
@@ -248,35 +653,175 @@ void malContextSetGain(MalContext *context, float gain) {
     }
 }
 
-bool malContextIsFormatValid(const MalContext *context, MalFormat format) {
+#ifdef MAL_USE_DEFAULT_FORMAT_IMPL
+
+static bool _malContextIsFormatValid(const MalContext *context, MalFormat format) {
     (void)context;
-    // TODO: Move to subsystem
-    return ((format.bitDepth == 8 || format.bitDepth == 16) &&
+    return (!format.isFloat && (format.bitDepth == 8 || format.bitDepth == 16) &&
             (format.numChannels == 1 || format.numChannels == 2));
 }
 
+#endif
+
+bool malContextIsFormatValid(const MalContext *context, MalFormat format) {
+    return _malContextIsFormatValid(context, format);
+}
+
+double malContextGetTime(MalContext *context) {
+    double time = 0.0;
+    if (!context || !_malContextGetTime(context, &time)) {
+        return 0.0;
+    }
+    return time;
+}
+
+void malContextBeginBatch(MalContext *context) {
+    if (context) {
+        context->batchDepth++;
+    }
+}
+
+void malContextCommitBatch(MalContext *context) {
+    if (context && context->batchDepth > 0) {
+        context->batchDepth--;
+        if (context->batchDepth == 0) {
+            _malContextCommitBatch(context);
+        }
+    }
+}
+
+bool malContextPrewarm(MalContext *context, MalFormat format, uint32_t count) {
+    if (!context || !malContextIsFormatValid(context, format)) {
+        return false;
+    }
+    return _malContextPrewarm(context, format, count);
+}
+
+MalContextStats malContextGetStats(const MalContext *context) {
+    MalContextStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (context) {
+        stats.copiedBufferBytes = context->bufferDataBytes[MAL_BUFFER_DATA_COPIED];
+        stats.noCopyBufferBytes = context->bufferDataBytes[MAL_BUFFER_DATA_NO_COPY];
+        stats.mappedBufferBytes = context->bufferDataBytes[MAL_BUFFER_DATA_MAPPED];
+        ok_vec_foreach(&context->streams, MalStream *stream) {
+            stats.streamBytes += (uint64_t)stream->numFrames * stream->frameSize;
+        }
+        stats.numBuffers = (uint32_t)context->buffers.count;
+        stats.numPlayers = (uint32_t)context->players.count;
+        stats.numStreams = (uint32_t)context->streams.count;
+        stats.numPendingFinishedCallbacks =
+            (uint32_t)atomic_load(&((MalContext *)context)->numFinishedPlayersWithCallbacks);
+        stats.numAudioSystemStreams = _malContextGetNumAudioSystemStreams(context);
+    }
+    return stats;
+}
+
+bool malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer) {
+    if (!context || !outBuffer) {
+        return false;
+    }
+    return _malContextRender(context, numFrames, outBuffer);
+}
+
+// Queues the player's `onFinished` callback for malContextPollEvents(). Called from any thread.
+static void _malContextQueueFinishedPlayer(MalContext *context, MalPlayer *player) {
+    malPlayerRetain(player);
+    (void)OK_ATOMIC_INC(&context->numFinishedPlayersWithCallbacks);
+    ok_queue_push(&context->finishedPlayersWithCallbacks, player);
+    _malContextSignalEvent(context);
+}
+
+int malContextGetEventFd(MalContext *context) {
+    if (!context) {
+        return -1;
+    }
+#if defined(MAL_HAS_EVENT_FD)
+    int eventFd = atomic_load(&context->eventFd);
+    if (eventFd < 0) {
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (eventFd >= 0) {
+            // Events may have been queued before the descriptor existed, so start readable
+            atomic_store(&context->eventFd, eventFd);
+            atomic_store(&context->eventSignaled, false);
+            _malContextSignalEvent(context);
+        }
+    }
+    return eventFd;
+#else
+    return -1;
+#endif
+}
+
 void malContextPollEvents(MalContext *context) {
     if (context) {
+        MAL_TRACE_BEGIN("malContextPollEvents");
+        _malContextClearEvent(context);
+        if (context->connecting) {
+            int connectResult = atomic_load(&context->connectResult);
+            if (connectResult != MAL_CONTEXT_CONNECTING) {
+                context->connecting = false;
+                if (connectResult != MAL_CONTEXT_CONNECTED || !_malContextActivate(context)) {
+                    atomic_store(&context->connectResult, MAL_CONTEXT_CONNECT_FAILED);
+                }
+            }
+        }
+        if (context->readyEventPending && !context->connecting) {
+            context->readyEventPending = false;
+            if (context->onReady) {
+                context->onReady(context, malContextIsReady(context), context->onReadyUserData);
+            }
+        }
+
+        MalStream *stream = NULL;
+        while (ok_queue_pop(&context->streamsWithEvents, &stream)) {
+            bool pending = true;
+            if (atomic_compare_exchange_strong(&stream->underrunEventPending, &pending, false) &&
+                stream->onUnderrun) {
+                stream->onUnderrun(stream, stream->onUnderrunUserData);
+            }
+            pending = true;
+            if (atomic_compare_exchange_strong(&stream->lowWatermarkEventPending, &pending,
+                                               false) && stream->onLowWatermark) {
+                stream->onLowWatermark(stream, stream->onLowWatermarkUserData);
+            }
+            malStreamRelease(stream);
+        }
+
         MalPlayer *player = NULL;
         while (ok_queue_pop(&context->finishedPlayersWithCallbacks, &player)) {
+            (void)OK_ATOMIC_DEC(&context->numFinishedPlayersWithCallbacks);
             if (player && player->onFinished) {
                 player->onFinished(player, player->onFinishedUserData);
             }
             malPlayerRelease(player);
         }
+        _malContextPollEvents(context);
+        MAL_TRACE_END("malContextPollEvents");
     }
 }
 
+static void _malVoicePoolDeinit(MalContext *context);
+
 static void _malContextFree(MalContext *context) {
     // Release players in unpolled events
     MalPlayer *finishedPlayer = NULL;
     while (ok_queue_pop(&context->finishedPlayersWithCallbacks, &finishedPlayer)) {
+        (void)OK_ATOMIC_DEC(&context->numFinishedPlayersWithCallbacks);
         malPlayerRelease(finishedPlayer);
     }
+    MalStream *streamWithEvents = NULL;
+    while (ok_queue_pop(&context->streamsWithEvents, &streamWithEvents)) {
+        malStreamRelease(streamWithEvents);
+    }
+
+    // Release voices
+    _malVoicePoolDeinit(context);
 
     // Dispose players
     ok_vec_foreach(&context->players, MalPlayer *player) {
         malPlayerSetBuffer(player, NULL);
+        malPlayerSetStream(player, NULL);
         malPlayerSetFinishedFunc(player, NULL, NULL);
         _malPlayerDispose(player);
         player->context = NULL;
@@ -286,6 +831,12 @@ static void _malContextFree(MalContext *context) {
     ok_vec_foreach(&context->buffers, MalBuffer *buffer) {
         _malBufferDispose(buffer);
         buffer->context = NULL;
+        buffer->cached = false;
+    }
+
+    // Streams have no audio system resources
+    ok_vec_foreach(&context->streams, MalStream *stream) {
+        stream->context = NULL;
     }
 
     // Dispose and free
@@ -295,7 +846,18 @@ static void _malContextFree(MalContext *context) {
 
     ok_vec_deinit(&context->players);
     ok_vec_deinit(&context->buffers);
+    ok_vec_deinit(&context->streams);
     ok_queue_deinit(&context->finishedPlayersWithCallbacks);
+    ok_queue_deinit(&context->streamsWithEvents);
+    if (context->bufferCache.m) {
+        ok_map_deinit(&context->bufferCache);
+    }
+#if defined(MAL_HAS_EVENT_FD)
+    const int eventFd = atomic_load(&context->eventFd);
+    if (eventFd >= 0) {
+        close(eventFd);
+    }
+#endif
     free(context);
 }
 
@@ -325,107 +887,763 @@ bool malContextIsFormatEqual(const MalContext *context, MalFormat format1, MalFo
     }
     return (format1.bitDepth == format2.bitDepth &&
             format1.numChannels == format2.numChannels &&
+            format1.isFloat == format2.isFloat &&
             _malSampleRatesEqual(format1.sampleRate, format2.sampleRate));
 }
 
-// MARK: Buffer
-
-#ifdef MAL_USE_DEFAULT_BUFFER_IMPL
-
-static bool _malBufferInit(MalContext *context, MalBuffer *buffer,
-                           const void *copiedData, void *managedData,
-                           const malDeallocatorFunc dataDeallocator) {
-    (void)context;
-    if (managedData) {
-        buffer->managedData = managedData;
-        buffer->managedDataDeallocator = dataDeallocator;
-    } else {
-        const size_t dataLength = ((buffer->format.bitDepth / 8) *
-                                   buffer->format.numChannels * buffer->numFrames);
-        void *newBuffer = malloc(dataLength);
-        if (!newBuffer) {
-            return false;
-        }
-        memcpy(newBuffer, copiedData, dataLength);
-        buffer->managedData = newBuffer;
-        buffer->managedDataDeallocator = free;
+// MARK: Render stats
+
+// Returns the time of a monotonic clock, in microseconds
+static uint64_t _malGetMicroseconds(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    const uint64_t seconds = (uint64_t)(counter.QuadPart / frequency.QuadPart);
+    const uint64_t remainder = (uint64_t)(counter.QuadPart % frequency.QuadPart);
+    return seconds * 1000000 + remainder * 1000000 / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec time;
+    if (clock_gettime(CLOCK_MONOTONIC, &time) != 0) {
+        return 0;
     }
-    return true;
+    return (uint64_t)time.tv_sec * 1000000 + (uint64_t)time.tv_nsec / 1000;
+#endif
 }
 
-static void _malBufferDispose(MalBuffer *buffer) {
-    (void)buffer;
-    // Do nothing
+static void _malRenderCountersAddUnderrun(struct MalRenderCounters *counters) {
+    atomic_store(&counters->numUnderruns, atomic_load(&counters->numUnderruns) + 1);
 }
 
-#endif
-
-static MalBuffer *_malBufferCreateInternal(MalContext *context, const MalFormat format,
-                                           const uint32_t numFrames, const void *copiedData,
-                                           void *managedData,
-                                           const malDeallocatorFunc dataDeallocator) {
-    // Check params
-    const bool oneNonNullData = (copiedData == NULL) != (managedData == NULL);
-    if (!context || !malContextIsFormatValid(context, format) || numFrames == 0 ||
-        !oneNonNullData) {
-        return NULL;
+// Records a render callback that started at `startMicros` (from _malGetMicroseconds).
+// `bytesCopied` is the part of `bytesWritten` copied into the audio system's memory.
+static void _malRenderCountersAddCallback(struct MalRenderCounters *counters,
+                                          uint64_t startMicros, size_t bytesRequested,
+                                          size_t bytesWritten, size_t bytesCopied) {
+    const uint64_t endMicros = _malGetMicroseconds();
+    const uint64_t elapsed = endMicros > startMicros ? endMicros - startMicros : 0;
+    const uint32_t micros = elapsed < UINT32_MAX ? (uint32_t)elapsed : UINT32_MAX;
+    const uint32_t numCallbacks = atomic_load(&counters->numCallbacks);
+    if (numCallbacks == 0 || micros < atomic_load(&counters->minCallbackMicros)) {
+        atomic_store(&counters->minCallbackMicros, micros);
     }
-    MalBuffer *buffer = (MalBuffer *)calloc(1, sizeof(MalBuffer));
-    if (buffer) {
-        atomic_store(&buffer->refCount, 1);
-        ok_vec_push(&context->buffers, buffer);
-        buffer->context = context;
-        buffer->format = format;
-        buffer->numFrames = numFrames;
-
-        bool success = _malBufferInit(context, buffer, copiedData, managedData,
-                                        dataDeallocator);
-        if (!success) {
-            malBufferRelease(buffer);
-            buffer = NULL;
-        }
+    if (micros > atomic_load(&counters->maxCallbackMicros)) {
+        atomic_store(&counters->maxCallbackMicros, micros);
     }
-    return buffer;
+    // The first bucket is under 125 microseconds, and each following bucket doubles the limit
+    size_t bucket = 0;
+    uint32_t bucketLimit = 125;
+    while (bucket < MAL_RENDER_TIME_HISTOGRAM_SIZE - 1 && micros >= bucketLimit) {
+        bucket++;
+        bucketLimit *= 2;
+    }
+    atomic_store(&counters->callbackHistogram[bucket],
+                 atomic_load(&counters->callbackHistogram[bucket]) + 1);
+    atomic_store(&counters->bytesRequested,
+                 atomic_load(&counters->bytesRequested) + bytesRequested);
+    atomic_store(&counters->bytesWritten, atomic_load(&counters->bytesWritten) + bytesWritten);
+    atomic_store(&counters->bytesCopied, atomic_load(&counters->bytesCopied) + bytesCopied);
+    atomic_store(&counters->numCallbacks, numCallbacks + 1);
 }
 
-MalBuffer *malBufferCreate(MalContext *context, MalFormat format, uint32_t numFrames,
-                           const void *data) {
-    return _malBufferCreateInternal(context, format, numFrames, data, NULL, NULL);
+static MalRenderStats _malRenderCountersGetStats(const struct MalRenderCounters *constCounters) {
+    struct MalRenderCounters *counters = (struct MalRenderCounters *)constCounters;
+    MalRenderStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.numUnderruns = atomic_load(&counters->numUnderruns);
+    stats.numRenderCallbacks = atomic_load(&counters->numCallbacks);
+    if (stats.numRenderCallbacks > 0) {
+        stats.minRenderTime = atomic_load(&counters->minCallbackMicros) / 1000000.0;
+        stats.maxRenderTime = atomic_load(&counters->maxCallbackMicros) / 1000000.0;
+    }
+    for (size_t i = 0; i < MAL_RENDER_TIME_HISTOGRAM_SIZE; i++) {
+        stats.renderTimeHistogram[i] = atomic_load(&counters->callbackHistogram[i]);
+    }
+    stats.bytesRequested = atomic_load(&counters->bytesRequested);
+    stats.bytesWritten = atomic_load(&counters->bytesWritten);
+    stats.bytesCopied = atomic_load(&counters->bytesCopied);
+    return stats;
 }
 
-MalBuffer *malBufferCreateNoCopy(MalContext *context, MalFormat format, uint32_t numFrames,
-                                 void *data, malDeallocatorFunc dataDeallocator) {
-    return _malBufferCreateInternal(context, format, numFrames, NULL, data, dataDeallocator);
+// Records an underrun of the player. Only called on the render thread.
+static void _malPlayerDidUnderrun(MalPlayer *player) {
+    _malRenderCountersAddUnderrun(&player->renderCounters);
+    if (player->context) {
+        _malRenderCountersAddUnderrun(&player->context->renderCounters);
+    }
 }
 
-MalFormat malBufferGetFormat(const MalBuffer *buffer) {
-    if (buffer) {
-        return buffer->format;
+MalRenderStats malContextGetRenderStats(const MalContext *context) {
+    if (context) {
+        return _malRenderCountersGetStats(&context->renderCounters);
     } else {
-        static const MalFormat nullFormat = {0, 0, 0};
-        return nullFormat;
+        MalRenderStats stats;
+        memset(&stats, 0, sizeof(stats));
+        return stats;
     }
 }
 
-uint32_t malBufferGetNumFrames(const MalBuffer *buffer) {
-    return buffer ? buffer->numFrames : 0;
-}
+// MARK: Tracing
 
-void *malBufferGetData(const MalBuffer *buffer) {
-    return buffer ? buffer->managedData : NULL;
-}
+#if defined(MAL_TRACE)
 
-static void _malBufferFree(MalBuffer *buffer) {
-    if (buffer->context) {
-        ok_vec_remove(&buffer->context->buffers, buffer);
-    }
-    _malBufferDispose(buffer);
-    if (buffer->managedData) {
-        if (buffer->managedDataDeallocator) {
-            buffer->managedDataDeallocator(buffer->managedData);
-        }
-        buffer->managedData = NULL;
-    }
+#if defined(_MSC_VER)
+#  define MAL_THREAD_LOCAL __declspec(thread)
+#else
+#  define MAL_THREAD_LOCAL __thread
+#endif
+
+#ifndef MAL_TRACE_MAX_THREADS
+#  define MAL_TRACE_MAX_THREADS 32
+#endif
+
+#ifndef MAL_TRACE_MAX_EVENTS
+#  define MAL_TRACE_MAX_EVENTS 65536 // Per thread
+#endif
+
+struct MalTraceEvent {
+    const char *name;
+    uint64_t time; // In microseconds
+    char phase; // Chrome trace event phase: 'B' (begin) or 'E' (end)
+};
+
+// Events of one thread. Only the thread writes; `numEvents` is stored after each event is written,
+// so events below it can be read from any thread.
+struct MalTraceThread {
+    _Atomic(uint32_t) numEvents;
+    struct MalTraceEvent events[MAL_TRACE_MAX_EVENTS];
+};
+
+// Threads are added to the first free slot, and never removed, because malTraceWriteFile() may be
+// reading a thread's events on another thread. See malTraceBegin() in mal.h.
+static _Atomic(struct MalTraceThread *) _malTraceThreads[MAL_TRACE_MAX_THREADS];
+static MAL_THREAD_LOCAL struct MalTraceThread *_malTraceCurrentThread;
+static MAL_THREAD_LOCAL bool _malTraceCurrentThreadFailed;
+
+static struct MalTraceThread *_malTraceGetCurrentThread(void) {
+    struct MalTraceThread *thread = _malTraceCurrentThread;
+    if (thread || _malTraceCurrentThreadFailed) {
+        return thread;
+    }
+    thread = (struct MalTraceThread *)calloc(1, sizeof(struct MalTraceThread));
+    for (size_t i = 0; thread && i < MAL_TRACE_MAX_THREADS; i++) {
+        struct MalTraceThread *expected = NULL;
+        if (atomic_compare_exchange_strong(&_malTraceThreads[i], &expected, thread)) {
+            _malTraceCurrentThread = thread;
+            return thread;
+        }
+    }
+    // Out of memory or slots
+    free(thread);
+    _malTraceCurrentThreadFailed = true;
+    return NULL;
+}
+
+static void _malTraceAdd(const char *name, char phase) {
+    struct MalTraceThread *thread = _malTraceGetCurrentThread();
+    if (thread) {
+        uint32_t numEvents = atomic_load(&thread->numEvents);
+        if (numEvents < MAL_TRACE_MAX_EVENTS) {
+            struct MalTraceEvent *event = &thread->events[numEvents];
+            event->name = name;
+            event->time = _malGetMicroseconds();
+            event->phase = phase;
+            atomic_store(&thread->numEvents, numEvents + 1);
+        }
+    }
+}
+
+static void _malTraceWriteString(FILE *file, const char *s) {
+    fputc('"', file);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', file);
+        }
+        if ((unsigned char)*s >= 0x20) {
+            fputc(*s, file);
+        }
+    }
+    fputc('"', file);
+}
+
+#endif
+
+void malTraceBegin(const char *name) {
+#if defined(MAL_TRACE)
+    if (name) {
+        MAL_TRACE_BEGIN(name);
+    }
+#else
+    (void)name;
+#endif
+}
+
+void malTraceEnd(const char *name) {
+#if defined(MAL_TRACE)
+    if (name) {
+        MAL_TRACE_END(name);
+    }
+#else
+    (void)name;
+#endif
+}
+
+bool malTraceWriteFile(const char *path) {
+#if defined(MAL_TRACE)
+    if (!path) {
+        return false;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    bool first = true;
+    fputs("{\"traceEvents\":[", file);
+    for (size_t i = 0; i < MAL_TRACE_MAX_THREADS; i++) {
+        struct MalTraceThread *thread = atomic_load(&_malTraceThreads[i]);
+        if (!thread) {
+            break;
+        }
+        const uint32_t numEvents = atomic_load(&thread->numEvents);
+        for (uint32_t j = 0; j < numEvents; j++) {
+            const struct MalTraceEvent *event = &thread->events[j];
+            fputs(first ? "\n{\"name\":" : ",\n{\"name\":", file);
+            _malTraceWriteString(file, event->name);
+            fprintf(file, ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%u}", event->phase,
+                    (unsigned long long)event->time, (unsigned int)i + 1);
+            first = false;
+        }
+    }
+    fputs("\n]}\n", file);
+    const bool writeFailed = ferror(file) != 0;
+    return fclose(file) == 0 && !writeFailed;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+// MARK: Memory-mapped files
+
+static void *_malFileMap(const char *path, size_t *length) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    void *data = NULL;
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 &&
+        (uint64_t)fileSize.QuadPart <= SIZE_MAX) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            // The view keeps the mapping alive
+            CloseHandle(mapping);
+        }
+        *length = (size_t)fileSize.QuadPart;
+    }
+    CloseHandle(file);
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    void *data = NULL;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode) && fileStat.st_size > 0 &&
+        (uint64_t)fileStat.st_size <= SIZE_MAX) {
+        data = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        }
+        *length = (size_t)fileStat.st_size;
+    }
+    // The mapping keeps the file alive
+    close(fd);
+    return data;
+#endif
+}
+
+static void _malFileUnmap(void *data, size_t length) {
+#if defined(_WIN32)
+    (void)length;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, length);
+#endif
+}
+
+// MARK: ADPCM
+
+static uint16_t _malReadLE16(const uint8_t *data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t _malReadLE32(const uint8_t *data) {
+    return ((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) |
+            ((uint32_t)data[3] << 24));
+}
+
+static uint32_t _malAdpcmGetBlockFrames(MalAdpcmEncoding encoding, uint32_t blockSize,
+                                        uint32_t numChannels) {
+    if (numChannels == 0 || numChannels > MAL_ADPCM_MAX_CHANNELS) {
+        return 0;
+    }
+    switch (encoding) {
+        case MAL_ADPCM_ENCODING_IMA:
+            // 4-byte header per channel, then groups of 4 bytes (8 samples) per channel
+            if (blockSize <= 4 * numChannels || (blockSize % (4 * numChannels)) != 0) {
+                return 0;
+            }
+            return (blockSize - 4 * numChannels) * 2 / numChannels + 1;
+        case MAL_ADPCM_ENCODING_MS:
+            // 7-byte header per channel (with two samples), then interleaved samples
+            if (blockSize <= 7 * numChannels || ((blockSize - 7 * numChannels) * 2) % numChannels) {
+                return 0;
+            }
+            return (blockSize - 7 * numChannels) * 2 / numChannels + 2;
+        default:
+            return 0;
+    }
+}
+
+static size_t _malBufferGetDataLength(const MalBuffer *buffer) {
+    if (buffer->adpcmBlockSize > 0) {
+        const size_t numBlocks = ((buffer->numFrames + (size_t)buffer->adpcmBlockFrames - 1) /
+                                  buffer->adpcmBlockFrames);
+        return numBlocks * buffer->adpcmBlockSize;
+    } else {
+        return ((size_t)(buffer->format.bitDepth / 8) * buffer->format.numChannels *
+                buffer->numFrames);
+    }
+}
+
+static inline int16_t _malAdpcmClamp(int32_t sample) {
+    return (int16_t)(sample < -32768 ? -32768 : (sample > 32767 ? 32767 : sample));
+}
+
+static inline int16_t _malAdpcmDecodeImaNibble(struct MalAdpcmChannel *channel, uint8_t nibble) {
+    static const int8_t indexTable[16] = {
+        -1, -1, -1, -1, 2, 4, 6, 8,
+        -1, -1, -1, -1, 2, 4, 6, 8
+    };
+    static const uint16_t stepTable[89] = {
+        7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60,
+        66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371,
+        408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707,
+        1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132,
+        7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+        27086, 29794, 32767
+    };
+    const int32_t step = stepTable[channel->delta];
+    int32_t diff = step >> 3;
+    if (nibble & 1) {
+        diff += step >> 2;
+    }
+    if (nibble & 2) {
+        diff += step >> 1;
+    }
+    if (nibble & 4) {
+        diff += step;
+    }
+    channel->sample1 = _malAdpcmClamp((nibble & 8) ? channel->sample1 - diff :
+                                      channel->sample1 + diff);
+    channel->delta += indexTable[nibble];
+    channel->delta = channel->delta < 0 ? 0 : (channel->delta > 88 ? 88 : channel->delta);
+    return (int16_t)channel->sample1;
+}
+
+static inline int16_t _malAdpcmDecodeMsNibble(struct MalAdpcmChannel *channel, uint8_t nibble) {
+    static const int32_t adaptationTable[16] = {
+        230, 230, 230, 230, 307, 409, 512, 614,
+        768, 614, 512, 409, 307, 230, 230, 230
+    };
+    const int32_t signedNibble = (nibble & 8) ? (int32_t)nibble - 16 : (int32_t)nibble;
+    // Shift instead of divide, like the reference decoder
+    int32_t predictor = ((channel->sample1 * channel->coef1 +
+                          channel->sample2 * channel->coef2) >> 8);
+    channel->sample2 = channel->sample1;
+    channel->sample1 = _malAdpcmClamp(predictor + signedNibble * channel->delta);
+    channel->delta = (adaptationTable[nibble] * channel->delta) >> 8;
+    if (channel->delta < 16) {
+        channel->delta = 16;
+    }
+    return (int16_t)channel->sample1;
+}
+
+// Decodes the first frame of a block from the block's header
+static void _malAdpcmDecoderStartBlock(struct MalAdpcmDecoder *decoder, const MalBuffer *buffer,
+                                       uint32_t block) {
+    static const int32_t msCoef1[7] = { 256, 512, 0, 192, 240, 460, 392 };
+    static const int32_t msCoef2[7] = { 0, -256, 0, 64, 0, -208, -232 };
+    const uint32_t numChannels = buffer->format.numChannels;
+    const uint8_t *header = ((const uint8_t *)buffer->managedData +
+                             (size_t)block * buffer->adpcmBlockSize);
+    decoder->buffer = buffer;
+    decoder->frame = block * buffer->adpcmBlockFrames;
+    for (uint32_t c = 0; c < numChannels; c++) {
+        struct MalAdpcmChannel *channel = decoder->channels + c;
+        if (buffer->adpcmEncoding == MAL_ADPCM_ENCODING_IMA) {
+            const uint8_t *channelHeader = header + c * 4;
+            channel->sample1 = (int16_t)_malReadLE16(channelHeader);
+            channel->delta = channelHeader[2] > 88 ? 88 : channelHeader[2];
+            decoder->samples[c] = (int16_t)channel->sample1;
+        } else {
+            const uint8_t coefIndex = header[c] > 6 ? 6 : header[c];
+            channel->coef1 = msCoef1[coefIndex];
+            channel->coef2 = msCoef2[coefIndex];
+            channel->delta = _malReadLE16(header + numChannels + c * 2);
+            channel->sample1 = (int16_t)_malReadLE16(header + numChannels * 3 + c * 2);
+            channel->sample2 = (int16_t)_malReadLE16(header + numChannels * 5 + c * 2);
+            // The header's second sample is played first
+            decoder->samples[c] = (int16_t)channel->sample2;
+        }
+    }
+}
+
+// Decodes the frame after the decoder's current frame
+static void _malAdpcmDecoderNext(struct MalAdpcmDecoder *decoder) {
+    const MalBuffer *buffer = decoder->buffer;
+    const uint32_t numChannels = buffer->format.numChannels;
+    const uint32_t frame = decoder->frame + 1;
+    const uint32_t block = frame / buffer->adpcmBlockFrames;
+    const uint32_t blockFrame = frame % buffer->adpcmBlockFrames;
+    memcpy(decoder->prevSamples, decoder->samples, sizeof(decoder->samples));
+    decoder->hasPrevSamples = true;
+    if (blockFrame == 0) {
+        _malAdpcmDecoderStartBlock(decoder, buffer, block);
+        return;
+    }
+    const uint8_t *blockData = ((const uint8_t *)buffer->managedData +
+                                (size_t)block * buffer->adpcmBlockSize);
+    decoder->frame = frame;
+    if (buffer->adpcmEncoding == MAL_ADPCM_ENCODING_IMA) {
+        // Each channel has 4 bytes (8 samples, low nibble first) per group
+        const uint32_t i = blockFrame - 1;
+        const uint8_t *group = blockData + numChannels * 4 * (i / 8 + 1) + (i % 8) / 2;
+        for (uint32_t c = 0; c < numChannels; c++) {
+            const uint8_t byte = group[c * 4];
+            const uint8_t nibble = (i & 1) ? (byte >> 4) : (byte & 0x0f);
+            decoder->samples[c] = _malAdpcmDecodeImaNibble(decoder->channels + c, nibble);
+        }
+    } else if (blockFrame == 1) {
+        for (uint32_t c = 0; c < numChannels; c++) {
+            decoder->samples[c] = (int16_t)decoder->channels[c].sample1;
+        }
+    } else {
+        // Interleaved samples, high nibble first
+        const uint32_t firstSample = (blockFrame - 2) * numChannels;
+        const uint8_t *samples = blockData + numChannels * 7;
+        for (uint32_t c = 0; c < numChannels; c++) {
+            const uint32_t i = firstSample + c;
+            const uint8_t byte = samples[i / 2];
+            const uint8_t nibble = (i & 1) ? (byte & 0x0f) : (byte >> 4);
+            decoder->samples[c] = _malAdpcmDecodeMsNibble(decoder->channels + c, nibble);
+        }
+    }
+}
+
+/**
+ Returns the decoded samples for a frame of an ADPCM buffer. Decoding continues from the previous
+ call if possible, so frames should be requested in increasing order. The previous frame is kept,
+ so interpolating between `frame` and `frame + 1` doesn't restart decoding.
+ */
+static const int16_t *_malAdpcmDecoderGetFrame(struct MalAdpcmDecoder *decoder,
+                                               const MalBuffer *buffer, uint32_t frame) {
+    const uint32_t blockFrames = buffer->adpcmBlockFrames;
+    if (decoder->buffer == buffer) {
+        if (frame == decoder->frame) {
+            return decoder->samples;
+        } else if (frame + 1 == decoder->frame && decoder->hasPrevSamples) {
+            return decoder->prevSamples;
+        }
+    }
+    if (decoder->buffer != buffer || frame < decoder->frame ||
+        (frame / blockFrames != decoder->frame / blockFrames && frame != decoder->frame + 1)) {
+        // Decode from the start of the frame's block
+        _malAdpcmDecoderStartBlock(decoder, buffer, frame / blockFrames);
+        decoder->hasPrevSamples = false;
+    }
+    while (decoder->frame < frame) {
+        _malAdpcmDecoderNext(decoder);
+    }
+    return decoder->samples;
+}
+
+// Decodes `numFrames` frames, starting at `frame`, to interleaved 16-bit PCM
+static void _malAdpcmDecoderRead(struct MalAdpcmDecoder *decoder, const MalBuffer *buffer,
+                                 uint32_t frame, uint32_t numFrames, int16_t *dst) {
+    if (numFrames == 0) {
+        return;
+    }
+    const uint32_t numChannels = buffer->format.numChannels;
+    const int16_t *samples = _malAdpcmDecoderGetFrame(decoder, buffer, frame);
+    memcpy(dst, samples, numChannels * sizeof(int16_t));
+    dst += numChannels;
+    for (uint32_t i = 1; i < numFrames; i++) {
+        _malAdpcmDecoderNext(decoder);
+        memcpy(dst, decoder->samples, numChannels * sizeof(int16_t));
+        dst += numChannels;
+    }
+}
+
+// Decodes an entire ADPCM buffer to a newly allocated 16-bit PCM buffer
+static int16_t *_malAdpcmDecodeAll(const MalBuffer *buffer) {
+    const size_t numSamples = (size_t)buffer->numFrames * buffer->format.numChannels;
+    int16_t *pcm = (int16_t *)malloc(numSamples * sizeof(int16_t));
+    if (pcm) {
+        struct MalAdpcmDecoder decoder;
+        memset(&decoder, 0, sizeof(decoder));
+        _malAdpcmDecoderRead(&decoder, buffer, 0, buffer->numFrames, pcm);
+    }
+    return pcm;
+}
+
+// MARK: Buffer
+
+#ifdef MAL_USE_DEFAULT_BUFFER_IMPL
+
+static bool _malBufferInit(MalContext *context, MalBuffer *buffer,
+                           const void *copiedData, void *managedData,
+                           const malDeallocatorFunc dataDeallocator) {
+    (void)context;
+    if (managedData) {
+        buffer->managedData = managedData;
+        buffer->managedDataDeallocator = dataDeallocator;
+    } else {
+        const size_t dataLength = _malBufferGetDataLength(buffer);
+        void *newBuffer = malloc(dataLength);
+        if (!newBuffer) {
+            return false;
+        }
+        memcpy(newBuffer, copiedData, dataLength);
+        buffer->managedData = newBuffer;
+        buffer->managedDataDeallocator = free;
+    }
+    return true;
+}
+
+static void _malBufferDispose(MalBuffer *buffer) {
+    (void)buffer;
+    // Do nothing
+}
+
+#endif
+
+// A variant of FNV-1a that mixes eight bytes at a time
+static uint64_t _malHashBytes(uint64_t hash, const void *data, size_t length) {
+    const uint64_t prime = 0x100000001b3ull;
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+        bytes += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        hash = (hash ^ *bytes++) * prime;
+        length--;
+    }
+    return hash;
+}
+
+// Hashes the format and data of a buffer that isn't initialized yet
+static uint64_t _malBufferHash(const MalBuffer *buffer, const void *data) {
+    const uint32_t params[] = {
+        buffer->format.bitDepth, buffer->format.numChannels, buffer->format.isFloat,
+        buffer->numFrames, (uint32_t)buffer->adpcmEncoding, buffer->adpcmBlockSize
+    };
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = _malHashBytes(hash, &buffer->format.sampleRate, sizeof(buffer->format.sampleRate));
+    hash = _malHashBytes(hash, params, sizeof(params));
+    return _malHashBytes(hash, data, _malBufferGetDataLength(buffer));
+}
+
+// Checks if a cached buffer has the same format and data as a buffer that isn't initialized yet
+static bool _malBuffersEqual(const MalBuffer *cachedBuffer, const MalBuffer *buffer,
+                             const void *data) {
+    return (cachedBuffer->format.sampleRate == buffer->format.sampleRate &&
+            cachedBuffer->format.bitDepth == buffer->format.bitDepth &&
+            cachedBuffer->format.numChannels == buffer->format.numChannels &&
+            cachedBuffer->format.isFloat == buffer->format.isFloat &&
+            cachedBuffer->numFrames == buffer->numFrames &&
+            cachedBuffer->adpcmEncoding == buffer->adpcmEncoding &&
+            cachedBuffer->adpcmBlockSize == buffer->adpcmBlockSize &&
+            cachedBuffer->managedData != NULL &&
+            memcmp(cachedBuffer->managedData, data, _malBufferGetDataLength(buffer)) == 0);
+}
+
+// Moves the buffer's data length to another counter of the context's `bufferDataBytes`
+static void _malBufferSetDataKind(MalBuffer *buffer, MalBufferDataKind kind) {
+    if (buffer->context) {
+        buffer->context->bufferDataBytes[buffer->dataKind] -= buffer->dataLength;
+        buffer->context->bufferDataBytes[kind] += buffer->dataLength;
+    }
+    buffer->dataKind = kind;
+}
+
+static MalBuffer *_malBufferCreateInternal(MalContext *context, const MalFormat format,
+                                           const uint32_t numFrames,
+                                           const MalAdpcmEncoding adpcmEncoding,
+                                           const uint32_t adpcmBlockSize, const void *copiedData,
+                                           void *managedData,
+                                           const malDeallocatorFunc dataDeallocator) {
+    // Check params
+    const bool oneNonNullData = (copiedData == NULL) != (managedData == NULL);
+    if (!context || !malContextIsFormatValid(context, format) || numFrames == 0 ||
+        !oneNonNullData) {
+        return NULL;
+    }
+    MalBuffer *buffer = (MalBuffer *)calloc(1, sizeof(MalBuffer));
+    if (buffer) {
+        atomic_store(&buffer->refCount, 1);
+        buffer->context = context;
+        buffer->format = format;
+        buffer->numFrames = numFrames;
+        if (adpcmBlockSize > 0) {
+            buffer->adpcmEncoding = adpcmEncoding;
+            buffer->adpcmBlockSize = adpcmBlockSize;
+            buffer->adpcmBlockFrames = _malAdpcmGetBlockFrames(adpcmEncoding, adpcmBlockSize,
+                                                               format.numChannels);
+        }
+        const bool useCache = copiedData && context->bufferCache.m;
+        if (useCache) {
+            buffer->contentHash = _malBufferHash(buffer, copiedData);
+            MalBuffer *cachedBuffer = ok_map_get(&context->bufferCache, buffer->contentHash);
+            if (cachedBuffer && _malBuffersEqual(cachedBuffer, buffer, copiedData)) {
+                free(buffer);
+                malBufferRetain(cachedBuffer);
+                return cachedBuffer;
+            }
+        }
+        ok_vec_push(&context->buffers, buffer);
+
+        bool success = _malBufferInit(context, buffer, copiedData, managedData,
+                                        dataDeallocator);
+        if (!success) {
+            malBufferRelease(buffer);
+            buffer = NULL;
+            return NULL;
+        }
+        // Audio systems that copy no-copy data (like Web Audio) don't keep `managedData`
+        const bool copied = copiedData || !buffer->managedData;
+        buffer->dataKind = copied ? MAL_BUFFER_DATA_COPIED : MAL_BUFFER_DATA_NO_COPY;
+        buffer->dataLength = _malBufferGetDataLength(buffer);
+        context->bufferDataBytes[buffer->dataKind] += buffer->dataLength;
+        if (useCache && buffer->managedData &&
+                   !ok_map_contains(&context->bufferCache, buffer->contentHash)) {
+            // On a hash collision, the first buffer stays in the cache
+            buffer->cached = ok_map_put(&context->bufferCache, buffer->contentHash, buffer);
+        }
+    }
+    return buffer;
+}
+
+static MalBuffer *_malBufferCreateAdpcmInternal(MalContext *context, const MalFormat format,
+                                                const uint32_t numFrames,
+                                                const MalAdpcmEncoding encoding,
+                                                const uint32_t blockSize, const void *copiedData,
+                                                void *managedData,
+                                                const malDeallocatorFunc dataDeallocator) {
+    if (format.bitDepth != 16 || format.isFloat ||
+        _malAdpcmGetBlockFrames(encoding, blockSize, format.numChannels) == 0) {
+        return NULL;
+    }
+#ifdef MAL_RENDERS_ADPCM_BUFFERS
+    return _malBufferCreateInternal(context, format, numFrames, encoding, blockSize, copiedData,
+                                    managedData, dataDeallocator);
+#else
+    // The audio system plays PCM buffers only, so decode now
+    if (!context || numFrames == 0 || (copiedData == NULL) == (managedData == NULL)) {
+        return NULL;
+    }
+    MalBuffer adpcmBuffer;
+    memset(&adpcmBuffer, 0, sizeof(adpcmBuffer));
+    adpcmBuffer.format = format;
+    adpcmBuffer.numFrames = numFrames;
+    adpcmBuffer.managedData = (void *)(copiedData ? copiedData : managedData);
+    adpcmBuffer.adpcmEncoding = encoding;
+    adpcmBuffer.adpcmBlockSize = blockSize;
+    adpcmBuffer.adpcmBlockFrames = _malAdpcmGetBlockFrames(encoding, blockSize,
+                                                           format.numChannels);
+    int16_t *pcm = _malAdpcmDecodeAll(&adpcmBuffer);
+    if (!pcm) {
+        return NULL;
+    }
+    MalBuffer *buffer = _malBufferCreateInternal(context, format, numFrames, encoding, 0, NULL,
+                                                 pcm, free);
+    if (!buffer) {
+        free(pcm);
+        return NULL;
+    }
+    _malBufferSetDataKind(buffer, MAL_BUFFER_DATA_COPIED);
+    if (managedData && dataDeallocator) {
+        dataDeallocator(managedData);
+    }
+    return buffer;
+#endif
+}
+
+MalBuffer *malBufferCreate(MalContext *context, MalFormat format, uint32_t numFrames,
+                           const void *data) {
+    return _malBufferCreateInternal(context, format, numFrames, MAL_ADPCM_ENCODING_IMA, 0, data,
+                                    NULL, NULL);
+}
+
+MalBuffer *malBufferCreateNoCopy(MalContext *context, MalFormat format, uint32_t numFrames,
+                                 void *data, malDeallocatorFunc dataDeallocator) {
+    return _malBufferCreateInternal(context, format, numFrames, MAL_ADPCM_ENCODING_IMA, 0, NULL,
+                                    data, dataDeallocator);
+}
+
+MalBuffer *malBufferCreateAdpcm(MalContext *context, MalFormat format, uint32_t numFrames,
+                                MalAdpcmEncoding encoding, uint32_t blockSize, const void *data) {
+    return _malBufferCreateAdpcmInternal(context, format, numFrames, encoding, blockSize, data,
+                                         NULL, NULL);
+}
+
+MalFormat malBufferGetFormat(const MalBuffer *buffer) {
+    if (buffer) {
+        return buffer->format;
+    } else {
+        static const MalFormat nullFormat = {0, 0, 0, false};
+        return nullFormat;
+    }
+}
+
+uint32_t malBufferGetNumFrames(const MalBuffer *buffer) {
+    return buffer ? buffer->numFrames : 0;
+}
+
+void *malBufferGetData(const MalBuffer *buffer) {
+    return (buffer && buffer->adpcmBlockSize == 0) ? buffer->managedData : NULL;
+}
+
+static void _malBufferFree(MalBuffer *buffer) {
+    if (buffer->context) {
+        ok_vec_remove(&buffer->context->buffers, buffer);
+        buffer->context->bufferDataBytes[buffer->dataKind] -= buffer->dataLength;
+        if (buffer->cached) {
+            ok_map_remove(&buffer->context->bufferCache, buffer->contentHash);
+        }
+    }
+    _malBufferDispose(buffer);
+    if (buffer->managedData) {
+        if (buffer->managedDataDeallocator) {
+            buffer->managedDataDeallocator(buffer->managedData);
+        }
+        buffer->managedData = NULL;
+    }
+    if (buffer->mappedFile) {
+        _malFileUnmap(buffer->mappedFile, buffer->mappedFileLength);
+        buffer->mappedFile = NULL;
+    }
     free(buffer);
 }
 
@@ -441,6 +1659,673 @@ void malBufferRelease(MalBuffer *buffer) {
     }
 }
 
+struct MalWavInfo {
+    MalFormat format;
+    size_t dataOffset;
+    uint32_t numFrames;
+    uint32_t adpcmBlockSize; // Zero for PCM
+    MalAdpcmEncoding adpcmEncoding;
+};
+
+/**
+ Finds the format and data of a RIFF WAVE file. Returns false if the file isn't a WAVE file or the
+ data isn't PCM, float, or ADPCM.
+ */
+static bool _malWavParse(const uint8_t *file, size_t fileLength, struct MalWavInfo *info) {
+    if (fileLength < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    MalFormat *format = &info->format;
+    bool hasFormat = false;
+    uint32_t factNumFrames = UINT32_MAX;
+    size_t offset = 12;
+    while (fileLength - offset >= 8) {
+        const uint8_t *chunk = file + offset;
+        const uint32_t chunkLength = _malReadLE32(chunk + 4);
+        offset += 8;
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunkLength < 16 || fileLength - offset < 16) {
+                return false;
+            }
+            uint16_t formatTag = _malReadLE16(chunk + 8);
+            if (formatTag == 0xFFFE && chunkLength >= 40 && fileLength - offset >= 40) {
+                // WAVE_FORMAT_EXTENSIBLE. The first two bytes of the sub-format GUID is the tag.
+                formatTag = _malReadLE16(chunk + 32);
+            }
+            const uint16_t numChannels = _malReadLE16(chunk + 10);
+            uint16_t bitDepth = _malReadLE16(chunk + 22);
+            info->adpcmBlockSize = 0;
+            if (formatTag == 0x11 || formatTag == 0x02) {
+                // ADPCM is decoded to 16-bit
+                info->adpcmEncoding = (formatTag == 0x11 ? MAL_ADPCM_ENCODING_IMA :
+                                       MAL_ADPCM_ENCODING_MS);
+                info->adpcmBlockSize = _malReadLE16(chunk + 20);
+                bitDepth = 16;
+            } else if (!(formatTag == 1 || (formatTag == 3 && bitDepth == 32)) || bitDepth > 32) {
+                return false;
+            }
+            if (numChannels > UINT8_MAX) {
+                return false;
+            }
+            format->numChannels = (uint8_t)numChannels;
+            format->sampleRate = _malReadLE32(chunk + 12);
+            format->bitDepth = (uint8_t)bitDepth;
+            format->isFloat = (formatTag == 3);
+            hasFormat = true;
+        } else if (memcmp(chunk, "fact", 4) == 0 && chunkLength >= 4 &&
+                   fileLength - offset >= 4) {
+            factNumFrames = _malReadLE32(chunk + 8);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!hasFormat || format->numChannels == 0 || format->bitDepth < 8) {
+                return false;
+            }
+            // Streamed files may have a placeholder length
+            const size_t dataLength = (chunkLength < fileLength - offset ?
+                                       chunkLength : fileLength - offset);
+            uint64_t numFrames;
+            if (info->adpcmBlockSize > 0) {
+                // Only complete blocks are used. The fact chunk has the length of the last block,
+                // but some encoders write an invalid fact chunk, so it's only used if the number
+                // of blocks agrees.
+                const uint32_t blockFrames = _malAdpcmGetBlockFrames(info->adpcmEncoding,
+                                                                     info->adpcmBlockSize,
+                                                                     format->numChannels);
+                if (blockFrames == 0) {
+                    return false;
+                }
+                const uint64_t numBlocks = dataLength / info->adpcmBlockSize;
+                numFrames = numBlocks * blockFrames;
+                if (factNumFrames < numFrames &&
+                    (factNumFrames + (uint64_t)blockFrames - 1) / blockFrames == numBlocks) {
+                    numFrames = factNumFrames;
+                }
+            } else {
+                numFrames = dataLength / ((format->bitDepth / 8) * format->numChannels);
+            }
+            if (numFrames > UINT32_MAX) {
+                return false;
+            }
+            info->dataOffset = offset;
+            info->numFrames = (uint32_t)numFrames;
+            return true;
+        }
+        // Chunks are word-aligned
+        const size_t paddedChunkLength = (size_t)chunkLength + (chunkLength & 1);
+        if (paddedChunkLength > fileLength - offset) {
+            return false;
+        }
+        offset += paddedChunkLength;
+    }
+    return false;
+}
+
+MalBuffer *malBufferCreateFromFile(MalContext *context, const char *path) {
+    if (!context || !path) {
+        return NULL;
+    }
+    size_t fileLength = 0;
+    uint8_t *file = (uint8_t *)_malFileMap(path, &fileLength);
+    if (!file) {
+        return NULL;
+    }
+    MalBuffer *buffer = NULL;
+    struct MalWavInfo info;
+    const uint16_t endianTest = 1;
+    const bool isLittleEndian = *(const uint8_t *)&endianTest == 1;
+    if (_malWavParse(file, fileLength, &info)) {
+        uint8_t *data = file + info.dataOffset;
+        MalFormat format = info.format;
+        if (info.adpcmBlockSize > 0) {
+            // ADPCM blocks are read byte-by-byte, so alignment and byte order don't matter
+            buffer = _malBufferCreateAdpcmInternal(context, format, info.numFrames,
+                                                   info.adpcmEncoding, info.adpcmBlockSize,
+                                                   NULL, data, NULL);
+        } else if (!isLittleEndian && format.bitDepth > 8) {
+            buffer = NULL;
+        } else if (format.bitDepth == 24 || ((uintptr_t)data % (format.bitDepth / 8)) == 0) {
+            // Packed 24-bit samples are read byte-by-byte
+            buffer = malBufferCreateNoCopy(context, format, info.numFrames, data, NULL);
+        } else {
+            // Misaligned samples; copy instead
+            buffer = malBufferCreate(context, format, info.numFrames, data);
+        }
+        if (buffer && buffer->managedData == data) {
+            // The buffer owns the mapping
+            buffer->mappedFile = file;
+            buffer->mappedFileLength = fileLength;
+            _malBufferSetDataKind(buffer, MAL_BUFFER_DATA_MAPPED);
+            file = NULL;
+        }
+    }
+    if (file) {
+        _malFileUnmap(file, fileLength);
+    }
+    return buffer;
+}
+
+// MARK: Samples
+
+// Reads a packed, native-endian 24-bit sample
+static inline int32_t _malGetInt24(const uint8_t *data) {
+    const uint16_t endianTest = 1;
+    uint32_t value;
+    if (*(const uint8_t *)&endianTest == 1) {
+        value = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16);
+    } else {
+        value = ((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | (uint32_t)data[2];
+    }
+    return (int32_t)(value ^ 0x800000u) - 0x800000;
+}
+
+static inline void _malSetInt24(uint8_t *data, int32_t value) {
+    const uint16_t endianTest = 1;
+    const uint32_t v = (uint32_t)value;
+    if (*(const uint8_t *)&endianTest == 1) {
+        data[0] = (uint8_t)v;
+        data[1] = (uint8_t)(v >> 8);
+        data[2] = (uint8_t)(v >> 16);
+    } else {
+        data[0] = (uint8_t)(v >> 16);
+        data[1] = (uint8_t)(v >> 8);
+        data[2] = (uint8_t)v;
+    }
+}
+
+// MARK: Resampler
+
+struct MalResampler {
+    // Each output frame advances the source position by `srcStep / dstStep` frames
+    uint64_t srcStep;
+    uint64_t dstStep;
+    uint32_t numPhases;
+    uint32_t numTaps; // Multiple of 4
+    // `numPhases` filters of `numTaps` coefficients each. Phase `p` interpolates the position
+    // `p / numPhases` frames after a source frame.
+    float *filter;
+};
+
+static uint64_t _malResamplerGCD(uint64_t a, uint64_t b) {
+    while (b != 0) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Modified Bessel function of the first kind, order zero. Used for the Kaiser window.
+static double _malResamplerBesselI0(double x) {
+    const double halfX = x / 2.0;
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 64; k++) {
+        term *= (halfX / k) * (halfX / k);
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static bool _malResamplerInit(struct MalResampler *resampler, double srcSampleRate,
+                              double dstSampleRate, MalResampleQuality quality) {
+    const uint32_t maxPhases = 1024;
+    uint32_t baseTaps;
+    double kaiserBeta;
+    double rolloff;
+    switch (quality) {
+        case MAL_RESAMPLE_QUALITY_LOW:
+            baseTaps = 8;
+            kaiserBeta = 5.0;
+            rolloff = 0.85;
+            break;
+        case MAL_RESAMPLE_QUALITY_MEDIUM: default:
+            baseTaps = 16;
+            kaiserBeta = 7.0;
+            rolloff = 0.90;
+            break;
+        case MAL_RESAMPLE_QUALITY_HIGH:
+            baseTaps = 32;
+            kaiserBeta = 9.0;
+            rolloff = 0.94;
+            break;
+    }
+
+    // Rates are rounded to whole numbers so the ratio is exact and positions don't drift
+    const uint64_t srcRate = (uint64_t)(srcSampleRate + 0.5);
+    const uint64_t dstRate = (uint64_t)(dstSampleRate + 0.5);
+    if (srcRate == 0 || dstRate == 0) {
+        return false;
+    }
+    const uint64_t gcd = _malResamplerGCD(srcRate, dstRate);
+    resampler->srcStep = srcRate / gcd;
+    resampler->dstStep = dstRate / gcd;
+    resampler->numPhases = (uint32_t)(resampler->dstStep < maxPhases ?
+                                      resampler->dstStep : maxPhases);
+
+    // When downsampling, the cutoff moves below the source Nyquist frequency, and the filter
+    // is widened to keep the same transition band.
+    double cutoff = rolloff;
+    uint32_t widen = 1;
+    if (srcRate > dstRate) {
+        cutoff *= (double)dstRate / (double)srcRate;
+        widen = (uint32_t)((srcRate + dstRate - 1) / dstRate);
+        widen = widen < 4 ? widen : 4;
+    }
+    resampler->numTaps = baseTaps * widen;
+
+    const uint32_t numPhases = resampler->numPhases;
+    const uint32_t numTaps = resampler->numTaps;
+    resampler->filter = (float *)malloc(sizeof(float) * numPhases * numTaps);
+    if (!resampler->filter) {
+        return false;
+    }
+    const double pi = 3.14159265358979323846;
+    const double halfWidth = numTaps / 2;
+    const double windowScale = 1.0 / _malResamplerBesselI0(kaiserBeta);
+    for (uint32_t p = 0; p < numPhases; p++) {
+        float *coefficients = resampler->filter + (size_t)p * numTaps;
+        const double offset = (double)p / (double)numPhases;
+        double sum = 0.0;
+        for (uint32_t k = 0; k < numTaps; k++) {
+            // Distance, in source frames, from the output position to this tap
+            const double t = (double)k - halfWidth + 1.0 - offset;
+            const double x = t / halfWidth;
+            double h = 0.0;
+            if (x > -1.0 && x < 1.0) {
+                const double window = _malResamplerBesselI0(kaiserBeta * sqrt(1.0 - x * x));
+                const double sinc = (t == 0.0) ? 1.0 : sin(pi * cutoff * t) / (pi * cutoff * t);
+                h = cutoff * sinc * window * windowScale;
+            }
+            coefficients[k] = (float)h;
+            sum += h;
+        }
+        // Normalize for unity gain at DC
+        for (uint32_t k = 0; k < numTaps; k++) {
+            coefficients[k] = (float)(coefficients[k] / sum);
+        }
+    }
+    return true;
+}
+
+static void _malResamplerDeinit(struct MalResampler *resampler) {
+    free(resampler->filter);
+    resampler->filter = NULL;
+}
+
+// Returns the dot product of `a` and `b`. `n` must be a multiple of 4.
+static inline float _malResamplerDot(const float *a, const float *b, uint32_t n) {
+#if defined(MAL_SIMD_SSE2)
+    __m128 sum = _mm_setzero_ps();
+    for (uint32_t i = 0; i < n; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif defined(MAL_SIMD_NEON)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (uint32_t i = 0; i < n; i += 4) {
+        sum = vmlaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float32x2_t sum2 = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+#else
+    float sum0 = 0.0f;
+    float sum1 = 0.0f;
+    float sum2 = 0.0f;
+    float sum3 = 0.0f;
+    for (uint32_t i = 0; i < n; i += 4) {
+        sum0 += a[i + 0] * b[i + 0];
+        sum1 += a[i + 1] * b[i + 1];
+        sum2 += a[i + 2] * b[i + 2];
+        sum3 += a[i + 3] * b[i + 3];
+    }
+    return (sum0 + sum1) + (sum2 + sum3);
+#endif
+}
+
+static inline float _malResamplerGetSample(const void *data, MalFormat format, size_t index) {
+    if (format.isFloat) {
+        return ((const float *)data)[index];
+    }
+    switch (format.bitDepth) {
+        case 8:
+            return (float)(((const uint8_t *)data)[index] - 128) * (1.0f / 128.0f);
+        case 16: default:
+            return (float)((const int16_t *)data)[index] * (1.0f / 32768.0f);
+        case 24:
+            return (float)_malGetInt24((const uint8_t *)data + index * 3) * (1.0f / 8388608.0f);
+        case 32:
+            return (float)((const int32_t *)data)[index] * (1.0f / 2147483648.0f);
+    }
+}
+
+static inline void _malResamplerSetSample(void *data, MalFormat format, size_t index,
+                                          float value) {
+    if (format.isFloat) {
+        ((float *)data)[index] = value;
+        return;
+    }
+    switch (format.bitDepth) {
+        case 8: {
+            float v = floorf(value * 128.0f + 128.5f);
+            v = v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+            ((uint8_t *)data)[index] = (uint8_t)v;
+            break;
+        }
+        case 16: default: {
+            float v = floorf(value * 32768.0f + 0.5f);
+            v = v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v);
+            ((int16_t *)data)[index] = (int16_t)v;
+            break;
+        }
+        case 24: {
+            float v = floorf(value * 8388608.0f + 0.5f);
+            v = v < -8388608.0f ? -8388608.0f : (v > 8388607.0f ? 8388607.0f : v);
+            _malSetInt24((uint8_t *)data + index * 3, (int32_t)v);
+            break;
+        }
+        case 32: {
+            // A float can't hold INT32_MAX exactly
+            double v = floor((double)value * 2147483648.0 + 0.5);
+            v = v < -2147483648.0 ? -2147483648.0 : (v > 2147483647.0 ? 2147483647.0 : v);
+            ((int32_t *)data)[index] = (int32_t)v;
+            break;
+        }
+    }
+}
+
+/**
+ Resamples `srcFrames` frames of `src` to `dstFrames` frames of `dst`. Both are in `format`
+ (except for the sample rate). Each channel is converted to float, padded with silence, and then
+ filtered.
+ */
+static bool _malResamplerProcess(const struct MalResampler *resampler, MalFormat format,
+                                 const void *src, uint32_t srcFrames, void *dst,
+                                 uint32_t dstFrames) {
+    const uint32_t numChannels = format.numChannels;
+    const uint32_t numTaps = resampler->numTaps;
+    const uint32_t numPhases = resampler->numPhases;
+    const uint64_t srcStep = resampler->srcStep;
+    const uint64_t dstStep = resampler->dstStep;
+    const uint64_t wholeStep = srcStep / dstStep;
+    const uint64_t remainderStep = srcStep % dstStep;
+    const size_t padding = numTaps;
+    float *plane = (float *)calloc((size_t)srcFrames + 2 * padding, sizeof(float));
+    if (!plane) {
+        return false;
+    }
+    for (uint32_t c = 0; c < numChannels; c++) {
+        for (uint32_t i = 0; i < srcFrames; i++) {
+            plane[padding + i] = _malResamplerGetSample(src, format, (size_t)i * numChannels + c);
+        }
+        // The first tap of the filter for output frame `n` is at source frame
+        // `frame - numTaps / 2 + 1`, where `frame + remainder / dstStep` is its position.
+        const float *start = plane + padding - numTaps / 2 + 1;
+        uint64_t frame = 0;
+        uint64_t remainder = 0;
+        for (uint32_t n = 0; n < dstFrames; n++) {
+            uint64_t phaseFrame = frame;
+            uint64_t phase = (remainder * numPhases + dstStep / 2) / dstStep;
+            if (phase == numPhases) {
+                phase = 0;
+                phaseFrame++;
+            }
+            const float *coefficients = resampler->filter + phase * numTaps;
+            const float value = _malResamplerDot(start + phaseFrame, coefficients, numTaps);
+            _malResamplerSetSample(dst, format, (size_t)n * numChannels + c, value);
+
+            frame += wholeStep;
+            remainder += remainderStep;
+            if (remainder >= dstStep) {
+                remainder -= dstStep;
+                frame++;
+            }
+        }
+    }
+    free(plane);
+    return true;
+}
+
+MalBuffer *malBufferCreateResampled(MalBuffer *buffer, double sampleRate,
+                                    MalResampleQuality quality) {
+    if (!buffer || !buffer->context) {
+        return NULL;
+    }
+    MalContext *context = buffer->context;
+    const MalFormat srcFormat = buffer->format;
+    double srcSampleRate = srcFormat.sampleRate;
+    if (srcSampleRate <= MAL_DEFAULT_SAMPLE_RATE) {
+        srcSampleRate = malContextGetSampleRate(context);
+    }
+    if (sampleRate <= MAL_DEFAULT_SAMPLE_RATE) {
+        sampleRate = malContextGetSampleRate(context);
+    }
+    if (_malSampleRatesEqual(srcSampleRate, sampleRate)) {
+        malBufferRetain(buffer);
+        return buffer;
+    }
+    if (!buffer->managedData) {
+        return NULL;
+    }
+    MalFormat dstFormat = srcFormat;
+    dstFormat.sampleRate = sampleRate;
+    if (!malContextIsFormatValid(context, dstFormat)) {
+        return NULL;
+    }
+
+    struct MalResampler resampler;
+    if (!_malResamplerInit(&resampler, srcSampleRate, sampleRate, quality)) {
+        return NULL;
+    }
+    const uint64_t dstFrames = (((uint64_t)buffer->numFrames * resampler.dstStep +
+                                 resampler.srcStep - 1) / resampler.srcStep);
+    const size_t frameSize = (size_t)(dstFormat.bitDepth / 8) * dstFormat.numChannels;
+    void *dstData = NULL;
+    if (dstFrames > 0 && dstFrames <= UINT32_MAX) {
+        dstData = malloc((size_t)dstFrames * frameSize);
+    }
+    if (!dstData) {
+        _malResamplerDeinit(&resampler);
+        return NULL;
+    }
+    // ADPCM buffers are decoded first. The resampled buffer is PCM.
+    int16_t *decodedData = NULL;
+    if (buffer->adpcmBlockSize > 0) {
+        decodedData = _malAdpcmDecodeAll(buffer);
+    }
+    bool success = false;
+    if (buffer->adpcmBlockSize == 0 || decodedData) {
+        success = _malResamplerProcess(&resampler, srcFormat,
+                                       decodedData ? decodedData : buffer->managedData,
+                                       buffer->numFrames, dstData, (uint32_t)dstFrames);
+    }
+    free(decodedData);
+    _malResamplerDeinit(&resampler);
+    if (!success) {
+        free(dstData);
+        return NULL;
+    }
+    MalBuffer *dstBuffer = malBufferCreateNoCopy(context, dstFormat, (uint32_t)dstFrames, dstData,
+                                                 free);
+    if (!dstBuffer) {
+        free(dstData);
+    } else {
+        _malBufferSetDataKind(dstBuffer, MAL_BUFFER_DATA_COPIED);
+    }
+    return dstBuffer;
+}
+
+// MARK: Stream
+
+MalStream *malStreamCreate(MalContext *context, MalFormat format, uint32_t numFrames) {
+    // Check params
+    if (!context || !malContextIsFormatValid(context, format) || numFrames == 0 ||
+        numFrames > 0x80000000u) {
+        return NULL;
+    }
+    uint32_t capacity = 1;
+    while (capacity < numFrames) {
+        capacity <<= 1;
+    }
+    MalStream *stream = (MalStream *)calloc(1, sizeof(MalStream));
+    if (stream) {
+        stream->frameSize = (uint32_t)(format.bitDepth / 8) * format.numChannels;
+        stream->data = (uint8_t *)malloc((size_t)capacity * stream->frameSize);
+        if (!stream->data) {
+            free(stream);
+            return NULL;
+        }
+        atomic_store(&stream->refCount, 1);
+        ok_vec_push(&context->streams, stream);
+        stream->context = context;
+        stream->format = format;
+        stream->numFrames = capacity;
+    }
+    return stream;
+}
+
+static void _malStreamFree(MalStream *stream) {
+    if (stream->context) {
+        ok_vec_remove(&stream->context->streams, stream);
+    }
+    free(stream->data);
+    free(stream);
+}
+
+void malStreamRetain(MalStream *stream) {
+    if (stream) {
+        (void)OK_ATOMIC_INC(&stream->refCount);
+    }
+}
+
+void malStreamRelease(MalStream *stream) {
+    if (stream && OK_ATOMIC_DEC(&stream->refCount) == 0) {
+        _malStreamFree(stream);
+    }
+}
+
+MalFormat malStreamGetFormat(const MalStream *stream) {
+    if (stream) {
+        return stream->format;
+    } else {
+        static const MalFormat nullFormat = {0, 0, 0, false};
+        return nullFormat;
+    }
+}
+
+uint32_t malStreamGetCapacity(const MalStream *stream) {
+    return stream ? stream->numFrames : 0;
+}
+
+static uint32_t _malStreamGetNumQueuedFrames(MalStream *stream) {
+    uint32_t readPosition = atomic_load(&stream->readPosition);
+    uint32_t writePosition = atomic_load(&stream->writePosition);
+    return writePosition - readPosition;
+}
+
+uint32_t malStreamGetNumQueuedFrames(const MalStream *stream) {
+    return stream ? _malStreamGetNumQueuedFrames((MalStream *)stream) : 0;
+}
+
+uint32_t malStreamWrite(MalStream *stream, const void *data, uint32_t numFrames) {
+    if (!stream || !data || atomic_load(&stream->ended)) {
+        return 0;
+    }
+    const uint32_t writePosition = atomic_load(&stream->writePosition);
+    const uint32_t freeFrames = stream->numFrames - _malStreamGetNumQueuedFrames(stream);
+    if (numFrames > freeFrames) {
+        numFrames = freeFrames;
+    }
+    const uint32_t index = writePosition & (stream->numFrames - 1);
+    const uint32_t endFrames = stream->numFrames - index;
+    const uint32_t firstFrames = numFrames < endFrames ? numFrames : endFrames;
+    memcpy(stream->data + (size_t)index * stream->frameSize, data,
+           (size_t)firstFrames * stream->frameSize);
+    memcpy(stream->data, (const uint8_t *)data + (size_t)firstFrames * stream->frameSize,
+           (size_t)(numFrames - firstFrames) * stream->frameSize);
+    atomic_store(&stream->writePosition, writePosition + numFrames);
+    return numFrames;
+}
+
+void malStreamEnd(MalStream *stream) {
+    if (stream) {
+        atomic_store(&stream->ended, true);
+    }
+}
+
+bool malStreamIsEnded(const MalStream *stream) {
+    return stream ? atomic_load(&((MalStream *)stream)->ended) : false;
+}
+
+void malStreamSetLowWatermarkFunc(MalStream *stream, uint32_t numFrames,
+                                  malStreamFunc onLowWatermark, void *userData) {
+    if (stream) {
+        stream->onLowWatermark = onLowWatermark;
+        stream->onLowWatermarkUserData = userData;
+        atomic_store(&stream->lowWatermark, numFrames);
+        atomic_store(&stream->hasLowWatermarkCallback, onLowWatermark != NULL);
+    }
+}
+
+void malStreamSetUnderrunFunc(MalStream *stream, malStreamFunc onUnderrun, void *userData) {
+    if (stream) {
+        stream->onUnderrun = onUnderrun;
+        stream->onUnderrunUserData = userData;
+        atomic_store(&stream->hasUnderrunCallback, onUnderrun != NULL);
+    }
+}
+
+uint32_t malStreamGetUnderrunCount(const MalStream *stream) {
+    return stream ? atomic_load(&((MalStream *)stream)->underrunCount) : 0;
+}
+
+// Stream functions called on the render thread
+
+static void _malStreamPostEvent(MalStream *stream, _Atomic(bool) *eventPending) {
+    bool pending = false;
+    if (stream->context && atomic_compare_exchange_strong(eventPending, &pending, true)) {
+        malStreamRetain(stream);
+        ok_queue_push(&stream->context->streamsWithEvents, stream);
+        _malContextSignalEvent(stream->context);
+    }
+}
+
+/**
+ Copies up to `maxFrames` queued frames to `dst`, and consumes them. Returns the number of frames
+ copied.
+ */
+static uint32_t _malStreamRead(MalStream *stream, void *dst, uint32_t maxFrames) {
+    const uint32_t readPosition = atomic_load(&stream->readPosition);
+    const uint32_t queuedFrames = _malStreamGetNumQueuedFrames(stream);
+    const uint32_t numFrames = maxFrames < queuedFrames ? maxFrames : queuedFrames;
+    const uint32_t index = readPosition & (stream->numFrames - 1);
+    const uint32_t endFrames = stream->numFrames - index;
+    const uint32_t firstFrames = numFrames < endFrames ? numFrames : endFrames;
+    memcpy(dst, stream->data + (size_t)index * stream->frameSize,
+           (size_t)firstFrames * stream->frameSize);
+    memcpy((uint8_t *)dst + (size_t)firstFrames * stream->frameSize, stream->data,
+           (size_t)(numFrames - firstFrames) * stream->frameSize);
+    atomic_store(&stream->readPosition, readPosition + numFrames);
+    return numFrames;
+}
+
+static void _malStreamDidRead(MalStream *stream) {
+    if (atomic_load(&stream->hasLowWatermarkCallback) && !atomic_load(&stream->ended) &&
+        _malStreamGetNumQueuedFrames(stream) <= atomic_load(&stream->lowWatermark)) {
+        _malStreamPostEvent(stream, &stream->lowWatermarkEventPending);
+    }
+}
+
+static void _malStreamDidUnderrun(MalStream *stream) {
+    atomic_store(&stream->underrunCount, atomic_load(&stream->underrunCount) + 1);
+    if (atomic_load(&stream->hasUnderrunCallback)) {
+        _malStreamPostEvent(stream, &stream->underrunEventPending);
+    }
+}
+
 // MARK: Player
 
 MalPlayer *malPlayerCreate(MalContext *context, MalFormat format) {
@@ -455,8 +2340,12 @@ MalPlayer *malPlayerCreate(MalContext *context, MalFormat format) {
         player->context = context;
         player->format = format;
         player->gain = 1.0f;
+        player->fade.gain = 1.0f;
+        player->fade.targetGain = 1.0f;
 
+        MAL_TRACE_BEGIN("_malPlayerInit");
         bool success = _malPlayerInit(player, format);
+        MAL_TRACE_END("_malPlayerInit");
         if (!success) {
             malPlayerRelease(player);
             player = NULL;
@@ -469,7 +2358,7 @@ MalFormat malPlayerGetFormat(const MalPlayer *player) {
     if (player) {
         return player->format;
     } else {
-        static const MalFormat null_format = {0, 0, 0};
+        static const MalFormat null_format = {0, 0, 0, false};
         return null_format;
     }
 }
@@ -481,6 +2370,9 @@ bool malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer) {
         return true;
     } else {
         malPlayerSetState(player, MAL_PLAYER_STATE_STOPPED);
+        if (buffer && player->stream) {
+            malPlayerSetStream(player, NULL);
+        }
         MalBuffer *oldBuffer = player->buffer;
         bool success = _malPlayerSetBuffer(player, buffer);
         if (success) {
@@ -495,6 +2387,30 @@ MalBuffer *malPlayerGetBuffer(const MalPlayer *player) {
     return player ? player->buffer : NULL;
 }
 
+bool malPlayerSetStream(MalPlayer *player, MalStream *stream) {
+    if (!player) {
+        return false;
+    } else if (player->stream == stream) {
+        return true;
+    } else {
+        malPlayerSetState(player, MAL_PLAYER_STATE_STOPPED);
+        if (stream && player->buffer) {
+            malPlayerSetBuffer(player, NULL);
+        }
+        MalStream *oldStream = player->stream;
+        bool success = _malPlayerSetStream(player, stream);
+        if (success) {
+            malStreamRetain(stream);
+            malStreamRelease(oldStream);
+        }
+        return success;
+    }
+}
+
+MalStream *malPlayerGetStream(const MalPlayer *player) {
+    return player ? player->stream : NULL;
+}
+
 void malPlayerSetFinishedFunc(MalPlayer *player, malPlaybackFinishedFunc onFinished,
                               void *userData) {
     if (player) {
@@ -523,13 +2439,40 @@ float malPlayerGetGain(const MalPlayer *player) {
     return player ? player->gain : 1.0f;
 }
 
+// Posts a fade to the render thread. Only called on the app thread.
+static void _malFadePost(struct MalFade *fade, float gain, double duration, bool stopWhenFaded) {
+    // The app thread is the only writer, so the serial doesn't need an atomic increment
+    const uint32_t serial = atomic_load(&fade->serial);
+    atomic_store(&fade->serial, serial + 1);
+    atomic_store(&fade->postedGain, gain);
+    atomic_store(&fade->postedDuration, (float)duration);
+    atomic_store(&fade->postedStopWhenFaded, stopWhenFaded);
+    if (duration == 0.0 && !stopWhenFaded) {
+        atomic_store(&fade->postedSetSerial, serial + 2);
+        atomic_store(&fade->postedSetGain, gain);
+    }
+    atomic_store(&fade->serial, serial + 2);
+}
+
 void malPlayerSetGain(MalPlayer *player, float gain) {
     if (player) {
         player->gain = gain;
+        _malFadePost(&player->fade, gain, 0.0, false);
         _malPlayerUpdateGain(player);
     }
 }
 
+bool malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded) {
+    if (!player || !(duration >= 0.0)) {
+        return false;
+    }
+    bool success = _malPlayerFadeTo(player, gain, duration, stopWhenFaded);
+    if (success) {
+        player->gain = gain;
+    }
+    return success;
+}
+
 bool malPlayerIsLooping(const MalPlayer *player) {
     return player ? player->looping : false;
 }
@@ -546,12 +2489,71 @@ bool malPlayerSetLooping(MalPlayer *player, bool looping) {
     }
 }
 
+bool malPlayerSetTargetLatency(MalPlayer *player, double latency) {
+    if (!player || latency < 0.0) {
+        return false;
+    }
+    bool success = _malPlayerSetTargetLatency(player, latency);
+    if (success) {
+        player->targetLatency = latency;
+    }
+    return success;
+}
+
+double malPlayerGetTargetLatency(const MalPlayer *player) {
+    return player ? player->targetLatency : 0.0;
+}
+
+double malPlayerGetLatency(MalPlayer *player) {
+    double latency = 0.0;
+    if (!player || !_malPlayerGetLatency(player, &latency)) {
+        return 0.0;
+    }
+    return latency;
+}
+
+MalRenderStats malPlayerGetRenderStats(const MalPlayer *player) {
+    if (player) {
+        return _malRenderCountersGetStats(&player->renderCounters);
+    } else {
+        MalRenderStats stats;
+        memset(&stats, 0, sizeof(stats));
+        return stats;
+    }
+}
+
 bool malPlayerSetState(MalPlayer *player, MalPlayerState state) {
-    if (!player || !player->buffer) {
+    if (!player || (!player->buffer && !player->stream)) {
         return false;
     } else {
+        if (state == MAL_PLAYER_STATE_PLAYING &&
+            atomic_load(&player->streamState) == MAL_STREAM_STOPPED) {
+            player->startFrame = 0;
+        }
+#if defined(MAL_TRACE)
+        static const char *traceNames[] = {
+            "_malPlayerSetState(stopped)", "_malPlayerSetState(playing)",
+            "_malPlayerSetState(paused)"
+        };
+        const char *traceName = ((size_t)state < sizeof(traceNames) / sizeof(*traceNames) ?
+                                 traceNames[state] : "_malPlayerSetState");
+        MAL_TRACE_BEGIN(traceName);
+        bool success = _malPlayerSetState(player, state);
+        MAL_TRACE_END(traceName);
+        return success;
+#else
         return _malPlayerSetState(player, state);
+#endif
+    }
+}
+
+bool malPlayerPlayAt(MalPlayer *player, double time) {
+    if (!player || !player->context || (!player->buffer && !player->stream)) {
+        return false;
     }
+    malPlayerSetState(player, MAL_PLAYER_STATE_STOPPED);
+    double startFrame = time * malContextGetSampleRate(player->context);
+    return _malPlayerPlayAt(player, startFrame > 0.0 ? (uint64_t)(startFrame + 0.5) : 0);
 }
 
 static MalPlayerState _malStreamStateToPlayerState(MalStreamState streamState) {
@@ -576,6 +2578,7 @@ MalPlayerState malPlayerGetState(MalPlayer *player) {
 
 static void _malPlayerFree(MalPlayer *player) {
     malPlayerSetBuffer(player, NULL);
+    malPlayerSetStream(player, NULL);
     malPlayerSetFinishedFunc(player, NULL, NULL);
     _malPlayerDispose(player);
     if (player->context) {
@@ -597,4 +2600,809 @@ void malPlayerRelease(MalPlayer *player) {
     }
 }
 
+// MARK: Voice pool
+
+// Returns true if voice `a` should be stolen before voice `b`
+static bool _malVoiceIsLower(const MalPlayer *a, const MalPlayer *b) {
+    if (a->voicePriority != b->voicePriority) {
+        return a->voicePriority < b->voicePriority;
+    } else {
+        return a->gain < b->gain;
+    }
+}
+
+static void _malVoicePoolSet(struct MalVoicePool *pool, size_t index, MalPlayer *voice) {
+    pool->activeVoices.values[index] = voice;
+    voice->voiceIndex = index;
+}
+
+static void _malVoicePoolSiftUp(struct MalVoicePool *pool, size_t index) {
+    MalPlayer *voice = ok_vec_get(&pool->activeVoices, index);
+    while (index > 0) {
+        size_t parentIndex = (index - 1) / 2;
+        MalPlayer *parent = ok_vec_get(&pool->activeVoices, parentIndex);
+        if (!_malVoiceIsLower(voice, parent)) {
+            break;
+        }
+        _malVoicePoolSet(pool, index, parent);
+        index = parentIndex;
+    }
+    _malVoicePoolSet(pool, index, voice);
+}
+
+static void _malVoicePoolSiftDown(struct MalVoicePool *pool, size_t index) {
+    const size_t count = pool->activeVoices.count;
+    MalPlayer *voice = ok_vec_get(&pool->activeVoices, index);
+    while (1) {
+        size_t childIndex = 2 * index + 1;
+        if (childIndex >= count) {
+            break;
+        }
+        MalPlayer *child = ok_vec_get(&pool->activeVoices, childIndex);
+        if (childIndex + 1 < count) {
+            MalPlayer *sibling = ok_vec_get(&pool->activeVoices, childIndex + 1);
+            if (_malVoiceIsLower(sibling, child)) {
+                child = sibling;
+                childIndex++;
+            }
+        }
+        if (!_malVoiceIsLower(child, voice)) {
+            break;
+        }
+        _malVoicePoolSet(pool, index, child);
+        index = childIndex;
+    }
+    _malVoicePoolSet(pool, index, voice);
+}
+
+static bool _malVoicePoolAddActive(struct MalVoicePool *pool, MalPlayer *voice) {
+    if (!ok_vec_push(&pool->activeVoices, voice)) {
+        return false;
+    }
+    voice->voiceActive = true;
+    _malVoicePoolSiftUp(pool, pool->activeVoices.count - 1);
+    return true;
+}
+
+static void _malVoicePoolRemoveActive(struct MalVoicePool *pool, MalPlayer *voice) {
+    MalPlayer *lastVoice = *ok_vec_last(&pool->activeVoices);
+    pool->activeVoices.count--;
+    voice->voiceActive = false;
+    if (lastVoice != voice) {
+        _malVoicePoolSet(pool, voice->voiceIndex, lastVoice);
+        _malVoicePoolSiftDown(pool, lastVoice->voiceIndex);
+        _malVoicePoolSiftUp(pool, lastVoice->voiceIndex);
+    }
+}
+
+static MalPlayerVec *_malVoicePoolGetIdleVoices(MalContext *context, MalFormat format) {
+    struct MalVoicePool *pool = &context->voicePool;
+    ok_vec_foreach_ptr(&pool->idleVoices, struct MalVoiceList *list) {
+        if (malContextIsFormatEqual(context, list->format, format)) {
+            return &list->players;
+        }
+    }
+    struct MalVoiceList *list = ok_vec_push_new(&pool->idleVoices);
+    if (!list) {
+        return NULL;
+    }
+    list->format = format;
+    ok_vec_init(&list->players);
+    return &list->players;
+}
+
+static void _malVoicePoolReleaseVoice(MalContext *context, MalPlayer *voice) {
+    context->voicePool.numVoices--;
+    malPlayerRelease(voice);
+}
+
+static void _malVoicePoolAddIdle(MalContext *context, MalPlayer *voice) {
+    malPlayerSetBuffer(voice, NULL);
+    MalPlayerVec *idleVoices = _malVoicePoolGetIdleVoices(context, voice->format);
+    if (!idleVoices || !ok_vec_push(idleVoices, voice)) {
+        _malVoicePoolReleaseVoice(context, voice);
+    }
+}
+
+static void _malVoiceDidFinish(MalPlayer *voice, void *userData) {
+    (void)userData;
+    // The voice may have been stolen and restarted since it finished
+    if (voice->context && voice->voiceActive &&
+        malPlayerGetState(voice) == MAL_PLAYER_STATE_STOPPED) {
+        _malVoicePoolRemoveActive(&voice->context->voicePool, voice);
+        _malVoicePoolAddIdle(voice->context, voice);
+    }
+}
+
+static MalPlayer *_malVoicePoolCreateVoice(MalContext *context, MalFormat format) {
+    MalPlayer *voice = malPlayerCreate(context, format);
+    if (voice) {
+        malPlayerSetFinishedFunc(voice, _malVoiceDidFinish, NULL);
+        context->voicePool.numVoices++;
+    }
+    return voice;
+}
+
+static MalPlayer *_malVoicePoolGetVoice(MalContext *context, MalFormat format, float gain,
+                                        int priority) {
+    struct MalVoicePool *pool = &context->voicePool;
+
+    // Reuse an idle voice
+    MalPlayerVec *idleVoices = _malVoicePoolGetIdleVoices(context, format);
+    if (idleVoices && idleVoices->count > 0) {
+        idleVoices->count--;
+        return ok_vec_get(idleVoices, idleVoices->count);
+    }
+
+    // Create a new voice
+    if (pool->numVoices < pool->maxVoices) {
+        MalPlayer *voice = _malVoicePoolCreateVoice(context, format);
+        if (voice) {
+            return voice;
+        }
+    }
+
+    // Replace an idle voice of another format
+    ok_vec_foreach_ptr(&pool->idleVoices, struct MalVoiceList *list) {
+        if (list->players.count > 0) {
+            list->players.count--;
+            _malVoicePoolReleaseVoice(context, ok_vec_get(&list->players, list->players.count));
+            return _malVoicePoolCreateVoice(context, format);
+        }
+    }
+
+    // Steal the lowest priority (or quietest) voice
+    if (pool->activeVoices.count == 0) {
+        return NULL;
+    }
+    MalPlayer *voice = ok_vec_get(&pool->activeVoices, 0);
+    if (voice->voicePriority > priority ||
+        (voice->voicePriority == priority && voice->gain > gain)) {
+        return NULL;
+    }
+    _malVoicePoolRemoveActive(pool, voice);
+    malPlayerSetState(voice, MAL_PLAYER_STATE_STOPPED);
+    if (malContextIsFormatEqual(context, voice->format, format)) {
+        return voice;
+    } else {
+        _malVoicePoolReleaseVoice(context, voice);
+        return _malVoicePoolCreateVoice(context, format);
+    }
+}
+
+bool malContextPlay(MalContext *context, MalBuffer *buffer, float gain, int priority) {
+    if (!context || !buffer || buffer->context != context) {
+        return false;
+    }
+    MalPlayer *voice = _malVoicePoolGetVoice(context, buffer->format, gain, priority);
+    if (!voice) {
+        return false;
+    }
+    voice->voicePriority = priority;
+    malPlayerSetGain(voice, gain);
+    if (!malPlayerSetBuffer(voice, buffer) ||
+        !malPlayerSetState(voice, MAL_PLAYER_STATE_PLAYING)) {
+        _malVoicePoolAddIdle(context, voice);
+        return false;
+    }
+    if (!_malVoicePoolAddActive(&context->voicePool, voice)) {
+        malPlayerSetState(voice, MAL_PLAYER_STATE_STOPPED);
+        _malVoicePoolAddIdle(context, voice);
+        return false;
+    }
+    return true;
+}
+
+static void _malVoicePoolDeinit(MalContext *context) {
+    struct MalVoicePool *pool = &context->voicePool;
+    ok_vec_foreach(&pool->activeVoices, MalPlayer *voice) {
+        voice->voiceActive = false;
+        malPlayerRelease(voice);
+    }
+    ok_vec_foreach_ptr(&pool->idleVoices, struct MalVoiceList *list) {
+        ok_vec_foreach(&list->players, MalPlayer *voice) {
+            malPlayerRelease(voice);
+        }
+        ok_vec_deinit(&list->players);
+    }
+    ok_vec_deinit(&pool->activeVoices);
+    ok_vec_deinit(&pool->idleVoices);
+    pool->numVoices = 0;
+}
+
+// MARK: Fades
+
+#ifdef MAL_INCLUDE_FADE_FUNCTIONS
+
+// Receives a fade posted since the last call, if any. Only called on the render thread.
+static void _malFadeReceive(struct MalFade *fade, uint32_t blockFrames, double sampleRate) {
+    const uint32_t serial = atomic_load(&fade->serial);
+    if (serial == fade->renderSerial || (serial & 1) != 0) {
+        return;
+    }
+    const float gain = atomic_load(&fade->postedGain);
+    const float duration = atomic_load(&fade->postedDuration);
+    const bool stopWhenFaded = atomic_load(&fade->postedStopWhenFaded);
+    const uint32_t setSerial = atomic_load(&fade->postedSetSerial);
+    const float setGain = atomic_load(&fade->postedSetGain);
+    if (atomic_load(&fade->serial) != serial) {
+        // Another fade is being posted. Receive it in the next block.
+        return;
+    }
+    if (setSerial != serial && (int32_t)(setSerial - fade->renderSerial) > 0) {
+        // A gain set was replaced before it was received. The player's gain was at the set gain
+        // when this fade was posted, so start from there.
+        fade->gain = setGain;
+        fade->targetGain = setGain;
+    }
+    fade->renderSerial = serial;
+
+    const double frames = (double)duration * sampleRate + 0.5;
+    uint32_t numFrames = frames < (double)UINT32_MAX ? (uint32_t)frames : UINT32_MAX;
+    if (numFrames == 0) {
+        if (fade->jumpToGain && !stopWhenFaded) {
+            fade->gain = gain;
+            fade->targetGain = gain;
+            fade->remainingFrames = 0;
+            fade->stopWhenFaded = false;
+            return;
+        }
+        // Ramp gain changes over one block to avoid zipper noise
+        numFrames = blockFrames > 0 ? blockFrames : 1;
+    }
+    fade->targetGain = gain;
+    fade->gainStep = (gain - fade->gain) / (float)numFrames;
+    fade->remainingFrames = numFrames;
+    fade->stopWhenFaded = stopWhenFaded;
+}
+
+/**
+ Called on the render thread when the player starts. Gain changes received before the first block
+ is rendered take effect immediately instead of ramping.
+ */
+static void _malFadeDidStart(struct MalFade *fade) {
+    fade->jumpToGain = true;
+}
+
+/**
+ Gets the gain of the next frames of a block of `maxFrames` frames at `sampleRate`. The gain ramps
+ linearly from `startGain` to `endGain` over the returned number of frames, which is less than
+ `maxFrames` if a fade ends within the block. Sets `stop` if a fade with `stopWhenFaded` ended at
+ the returned number of frames. Only called on the render thread.
+ */
+static uint32_t _malFadeNext(struct MalFade *fade, uint32_t maxFrames, double sampleRate,
+                             float *startGain, float *endGain, bool *stop) {
+    _malFadeReceive(fade, maxFrames, sampleRate);
+    fade->jumpToGain = false;
+    *startGain = fade->gain;
+    *stop = false;
+    if (fade->remainingFrames == 0) {
+        *endGain = fade->gain;
+        return maxFrames;
+    }
+    const uint32_t numFrames = (fade->remainingFrames < maxFrames ?
+                                fade->remainingFrames : maxFrames);
+    fade->remainingFrames -= numFrames;
+    if (fade->remainingFrames == 0) {
+        fade->gain = fade->targetGain;
+        *stop = fade->stopWhenFaded;
+        fade->stopWhenFaded = false;
+    } else {
+        fade->gain += fade->gainStep * (float)numFrames;
+    }
+    *endGain = fade->gain;
+    return numFrames;
+}
+
+/**
+ Advances the fade by `numFrames` frames at `sampleRate`, and returns the gain after them. Sets
+ `stop` if a fade with `stopWhenFaded` ended. For audio systems that set the gain once per block.
+ Only called on the render thread.
+ */
+static inline float _malFadeAdvance(struct MalFade *fade, uint32_t numFrames,
+                                    double sampleRate, bool *stop) {
+    float startGain;
+    float endGain = fade->gain;
+    *stop = false;
+    while (numFrames > 0 && !*stop) {
+        numFrames -= _malFadeNext(fade, numFrames, sampleRate, &startGain, &endGain, stop);
+    }
+    return endGain;
+}
+
+// Returns true if the fade's gain is 1.0 and no fade is in progress or posted. Only called on the
+// render thread.
+static inline bool _malFadeIsUnity(struct MalFade *fade) {
+    return (fade->gain == 1.0f && fade->remainingFrames == 0 &&
+            atomic_load(&fade->serial) == fade->renderSerial);
+}
+
+#endif
+
+// MARK: Software mixer
+
+#ifdef MAL_INCLUDE_MIXER_FUNCTIONS
+
+static inline float _malMixerGetSample(const void *data, MalFormat format, size_t index) {
+    if (format.isFloat) {
+        return ((const float *)data)[index];
+    }
+    switch (format.bitDepth) {
+        case 8:
+            return (float)(((const uint8_t *)data)[index] - 128) * (1.0f / 128.0f);
+        case 16: default:
+            return (float)((const int16_t *)data)[index] * (1.0f / 32768.0f);
+        case 24:
+            return (float)_malGetInt24((const uint8_t *)data + index * 3) * (1.0f / 8388608.0f);
+        case 32:
+            return (float)((const int32_t *)data)[index] * (1.0f / 2147483648.0f);
+    }
+}
+
+#define MAL_DOWNMIX_M 0.70710678f
+
+/*
+ Stereo downmix coefficients for 3 to 8 channel sources, in the speaker order documented for
+ MalFormat. Center and surround channels are attenuated by 3dB, and the LFE channel is dropped.
+ */
+static const float MAL_MIXER_DOWNMIX[MAL_MAX_CHANNELS - 2][MAL_MAX_CHANNELS][2] = {
+    // FL, FR, FC
+    { {1.0f, 0.0f}, {0.0f, 1.0f}, {MAL_DOWNMIX_M, MAL_DOWNMIX_M} },
+    // FL, FR, BL, BR
+    { {1.0f, 0.0f}, {0.0f, 1.0f}, {MAL_DOWNMIX_M, 0.0f}, {0.0f, MAL_DOWNMIX_M} },
+    // FL, FR, FC, BL, BR
+    { {1.0f, 0.0f}, {0.0f, 1.0f}, {MAL_DOWNMIX_M, MAL_DOWNMIX_M}, {MAL_DOWNMIX_M, 0.0f},
+      {0.0f, MAL_DOWNMIX_M} },
+    // FL, FR, FC, LFE, BL, BR
+    { {1.0f, 0.0f}, {0.0f, 1.0f}, {MAL_DOWNMIX_M, MAL_DOWNMIX_M}, {0.0f, 0.0f},
+      {MAL_DOWNMIX_M, 0.0f}, {0.0f, MAL_DOWNMIX_M} },
+    // FL, FR, FC, LFE, BC, SL, SR
+    { {1.0f, 0.0f}, {0.0f, 1.0f}, {MAL_DOWNMIX_M, MAL_DOWNMIX_M}, {0.0f, 0.0f},
+      {0.5f, 0.5f}, {MAL_DOWNMIX_M, 0.0f}, {0.0f, MAL_DOWNMIX_M} },
+    // FL, FR, FC, LFE, BL, BR, SL, SR
+    { {1.0f, 0.0f}, {0.0f, 1.0f}, {MAL_DOWNMIX_M, MAL_DOWNMIX_M}, {0.0f, 0.0f},
+      {MAL_DOWNMIX_M, 0.0f}, {0.0f, MAL_DOWNMIX_M}, {MAL_DOWNMIX_M, 0.0f},
+      {0.0f, MAL_DOWNMIX_M} },
+};
+
+#undef MAL_DOWNMIX_M
+
+static inline float _malMixerGetFrameSample(const void *data, MalFormat format, uint32_t frame,
+                                            uint32_t channel, uint32_t numChannels) {
+    const uint32_t srcChannels = format.numChannels;
+    const size_t index = (size_t)frame * srcChannels;
+    if (srcChannels == numChannels) {
+        return _malMixerGetSample(data, format, index + channel);
+    } else if (srcChannels == 1) {
+        return _malMixerGetSample(data, format, index);
+    } else if (numChannels == 1) {
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < srcChannels; i++) {
+            sum += _malMixerGetSample(data, format, index + i);
+        }
+        return sum / (float)srcChannels;
+    } else if (numChannels == 2 && srcChannels <= MAL_MAX_CHANNELS) {
+        const float (*coefficients)[2] = MAL_MIXER_DOWNMIX[srcChannels - 3];
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < srcChannels; i++) {
+            sum += coefficients[i][channel] * _malMixerGetSample(data, format, index + i);
+        }
+        return sum;
+    } else if (channel < srcChannels) {
+        return _malMixerGetSample(data, format, index + channel);
+    } else {
+        return 0.0f;
+    }
+}
+
+// Returns the 32.32 fixed point step, in source frames, for each output frame
+static uint64_t _malMixerGetStep(MalFormat format, double sampleRate) {
+    const uint64_t unitStep = (uint64_t)1 << 32;
+    double srcSampleRate = format.sampleRate;
+    if (srcSampleRate <= MAL_DEFAULT_SAMPLE_RATE ||
+        _malSampleRatesEqual(srcSampleRate, sampleRate)) {
+        return unitStep;
+    } else {
+        return (uint64_t)(srcSampleRate / sampleRate * (double)unitStep + 0.5);
+    }
+}
+
+/**
+ Gets the data containing a buffer frame, and sets `index` to the frame's index in that data.
+ Frames of ADPCM buffers are decoded to `adpcmFrame`.
+ */
+static inline const void *_malMixerGetBufferFrame(const MalBuffer *buffer,
+                                                  struct MalAdpcmDecoder *adpcmDecoder,
+                                                  uint32_t frame, int16_t *adpcmFrame,
+                                                  uint32_t *index) {
+    if (buffer->adpcmBlockSize == 0) {
+        *index = frame;
+        return buffer->managedData;
+    }
+    memcpy(adpcmFrame, _malAdpcmDecoderGetFrame(adpcmDecoder, buffer, frame),
+           buffer->format.numChannels * sizeof(int16_t));
+    *index = 0;
+    return adpcmFrame;
+}
+
+/**
+ Adds the buffer's frames, starting at the voice's position, to `dst`. The gain starts at `gain`
+ and changes by `gainStep` each frame. Returns `true` if the end of a non-looping buffer was
+ reached.
+ */
+static bool _malMixerMixBuffer(const MalBuffer *buffer, struct MalMixerVoice *voice,
+                               struct MalAdpcmDecoder *adpcmDecoder, bool looping, float *dst,
+                               uint32_t numFrames, uint32_t numChannels, double sampleRate,
+                               float gain, float gainStep) {
+    const uint32_t srcFrames = buffer->numFrames;
+    const MalFormat format = buffer->format;
+    int16_t adpcmFrame1[MAL_ADPCM_MAX_CHANNELS];
+    int16_t adpcmFrame2[MAL_ADPCM_MAX_CHANNELS];
+    uint32_t index1;
+    uint32_t index2;
+
+    // Position and step are 32.32 fixed point
+    const uint64_t step = _malMixerGetStep(format, sampleRate);
+    uint64_t position = ((uint64_t)voice->nextFrame << 32) | voice->nextFrameFraction;
+    bool finished = false;
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        uint32_t frame = (uint32_t)(position >> 32);
+        if (frame >= srcFrames) {
+            if (!looping) {
+                finished = true;
+                break;
+            }
+            frame %= srcFrames;
+            position = ((uint64_t)frame << 32) | (uint32_t)position;
+        }
+        const uint32_t fraction = (uint32_t)position;
+        const float frameGain = gain + gainStep * (float)i;
+        const void *data1 = _malMixerGetBufferFrame(buffer, adpcmDecoder, frame, adpcmFrame1,
+                                                    &index1);
+        if (fraction == 0) {
+            for (uint32_t c = 0; c < numChannels; c++) {
+                *dst++ += frameGain * _malMixerGetFrameSample(data1, format, index1, c,
+                                                              numChannels);
+            }
+        } else {
+            // Linear interpolation
+            uint32_t nextFrame = frame + 1;
+            if (nextFrame >= srcFrames) {
+                nextFrame = looping ? 0 : frame;
+            }
+            const void *data2 = _malMixerGetBufferFrame(buffer, adpcmDecoder, nextFrame,
+                                                        adpcmFrame2, &index2);
+            const float t = (float)fraction * (1.0f / 4294967296.0f);
+            for (uint32_t c = 0; c < numChannels; c++) {
+                float s1 = _malMixerGetFrameSample(data1, format, index1, c, numChannels);
+                float s2 = _malMixerGetFrameSample(data2, format, index2, c, numChannels);
+                *dst++ += frameGain * (s1 + (s2 - s1) * t);
+            }
+        }
+        position += step;
+    }
+
+    voice->nextFrame = (uint32_t)(position >> 32);
+    voice->nextFrameFraction = (uint32_t)position;
+    return finished;
+}
+
+/**
+ Adds the stream's queued frames to `dst`, and consumes them. The gain starts at `gain` and changes
+ by `gainStep` each frame. Returns the number of frames added, which is less than `numFrames` if the
+ stream ran out of frames.
+ */
+static uint32_t _malMixerMixStream(MalStream *stream, struct MalMixerVoice *voice, float *dst,
+                                   uint32_t numFrames, uint32_t numChannels, double sampleRate,
+                                   float gain, float gainStep) {
+    const void *data = stream->data;
+    const MalFormat format = stream->format;
+    const uint32_t mask = stream->numFrames - 1;
+    const uint32_t queuedFrames = _malStreamGetNumQueuedFrames(stream);
+    const uint32_t readPosition = atomic_load(&stream->readPosition);
+
+    // Position (relative to the read position) and step are 32.32 fixed point
+    const uint64_t step = _malMixerGetStep(format, sampleRate);
+    uint64_t position = voice->nextFrameFraction;
+    uint32_t i;
+
+    for (i = 0; i < numFrames; i++) {
+        const uint32_t frame = (uint32_t)(position >> 32);
+        const uint32_t fraction = (uint32_t)position;
+        if (frame >= queuedFrames || (fraction != 0 && frame + 1 >= queuedFrames)) {
+            break;
+        }
+        const uint32_t ringFrame = (readPosition + frame) & mask;
+        const float frameGain = gain + gainStep * (float)i;
+        if (fraction == 0) {
+            for (uint32_t c = 0; c < numChannels; c++) {
+                *dst++ += frameGain * _malMixerGetFrameSample(data, format, ringFrame, c,
+                                                              numChannels);
+            }
+        } else {
+            // Linear interpolation
+            const uint32_t nextRingFrame = (readPosition + frame + 1) & mask;
+            const float t = (float)fraction * (1.0f / 4294967296.0f);
+            for (uint32_t c = 0; c < numChannels; c++) {
+                float s1 = _malMixerGetFrameSample(data, format, ringFrame, c, numChannels);
+                float s2 = _malMixerGetFrameSample(data, format, nextRingFrame, c, numChannels);
+                *dst++ += frameGain * (s1 + (s2 - s1) * t);
+            }
+        }
+        position += step;
+    }
+
+    uint64_t consumedFrames = position >> 32;
+    if (consumedFrames > queuedFrames) {
+        consumedFrames = queuedFrames;
+    }
+    atomic_store(&stream->readPosition, readPosition + (uint32_t)consumedFrames);
+    voice->nextFrame = 0;
+    voice->nextFrameFraction = (uint32_t)position;
+    return i;
+}
+
+/**
+ Mixes the player's `buffer` or `stream` into `dst`, which is interleaved 32-bit float audio with
+ `numChannels` channels at `sampleRate`. The first frame of `dst` is at `frameTime` of the
+ context's audio clock. The player's gain and fade are applied in addition to `gain`. Handles
+ stream state transitions and scheduled starts, and queues the finished callback when a
+ non-looping buffer or an ended stream finishes, or a fade stops the player.
+
+ The caller must make sure `buffer` and `stream` aren't freed during this call.
+ */
+static void _malMixerRenderPlayer(MalPlayer *player, MalBuffer *buffer, MalStream *stream,
+                                  float *dst, uint32_t numFrames, uint32_t numChannels,
+                                  double sampleRate, float gain, uint64_t frameTime) {
+    if (stream == NULL && (buffer == NULL || buffer->managedData == NULL)) {
+        return;
+    }
+    MalStreamState streamState = atomic_load(&player->streamState);
+    if (streamState == MAL_STREAM_STARTING) {
+        if (player->startFrame > frameTime) {
+            uint64_t delayFrames = player->startFrame - frameTime;
+            if (delayFrames >= numFrames) {
+                return;
+            }
+            dst += delayFrames * numChannels;
+            numFrames -= (uint32_t)delayFrames;
+        }
+        player->voice.nextFrame = 0;
+        player->voice.nextFrameFraction = 0;
+        player->voice.streamStarved = true;
+        player->adpcmDecoder.buffer = NULL;
+        _malFadeDidStart(&player->fade);
+        if (atomic_compare_exchange_strong(&player->streamState, &streamState,
+                                           MAL_STREAM_PLAYING)) {
+            streamState = MAL_STREAM_PLAYING;
+        }
+    } else if (streamState == MAL_STREAM_RESUMING) {
+        if (atomic_compare_exchange_strong(&player->streamState, &streamState,
+                                           MAL_STREAM_PLAYING)) {
+            streamState = MAL_STREAM_PLAYING;
+        }
+    }
+    if (streamState != MAL_STREAM_PLAYING) {
+        return;
+    }
+
+    // Mix in segments of constant or linearly ramping fade gain
+    bool finished = false;
+    bool streamStarved = false;
+    const bool looping = atomic_load(&player->looping);
+    while (numFrames > 0) {
+        float fadeStartGain;
+        float fadeEndGain;
+        bool stopWhenFaded;
+        const uint32_t segmentFrames = _malFadeNext(&player->fade, numFrames, sampleRate,
+                                                    &fadeStartGain, &fadeEndGain,
+                                                    &stopWhenFaded);
+        const float segmentGain = gain * fadeStartGain;
+        const float gainStep = gain * (fadeEndGain - fadeStartGain) / (float)segmentFrames;
+        if (stream) {
+            uint32_t mixedFrames = _malMixerMixStream(stream, &player->voice, dst, segmentFrames,
+                                                      numChannels, sampleRate, segmentGain,
+                                                      gainStep);
+            streamStarved = (mixedFrames < segmentFrames);
+        } else {
+            finished = _malMixerMixBuffer(buffer, &player->voice, &player->adpcmDecoder, looping,
+                                          dst, segmentFrames, numChannels, sampleRate,
+                                          segmentGain, gainStep);
+        }
+        if (stopWhenFaded) {
+            finished = true;
+        }
+        if (finished || streamStarved) {
+            break;
+        }
+        dst += (size_t)segmentFrames * numChannels;
+        numFrames -= segmentFrames;
+    }
+    if (stream) {
+        if (!streamStarved) {
+            player->voice.streamStarved = false;
+        } else if (atomic_load(&stream->ended)) {
+            finished = true;
+        } else if (!finished && !player->voice.streamStarved) {
+            player->voice.streamStarved = true;
+            _malStreamDidUnderrun(stream);
+            _malPlayerDidUnderrun(player);
+        }
+        _malStreamDidRead(stream);
+    }
+    if (finished && atomic_compare_exchange_strong(&player->streamState, &streamState,
+                                                   MAL_STREAM_STOPPED)) {
+        if (atomic_load(&player->hasOnFinishedCallback) && player->context) {
+            _malContextQueueFinishedPlayer(player->context, player);
+        }
+    }
+}
+
+#endif
+
+// MARK: Gain
+
+#ifdef MAL_INCLUDE_GAIN_FUNCTIONS
+
+#if defined(MAL_SIMD_SSE2)
+
+// Multiplies 8 samples by `gains0` (the first 4 samples) and `gains1`, with saturation
+static inline __m128i _malGainApplyInt16x8(__m128i samples, __m128 gains0, __m128 gains1) {
+    __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16));
+    __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16));
+    return _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(lo, gains0)),
+                           _mm_cvtps_epi32(_mm_mul_ps(hi, gains1)));
+}
+
+#elif defined(MAL_SIMD_NEON)
+
+// Multiplies 8 samples by `gains0` (the first 4 samples) and `gains1`, with saturation
+static inline int16x8_t _malGainApplyInt16x8(int16x8_t samples, float32x4_t gains0,
+                                             float32x4_t gains1) {
+    float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples)));
+    float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples)));
+    return vcombine_s16(vqmovn_s32(vcvtq_s32_f32(vmulq_f32(lo, gains0))),
+                        vqmovn_s32(vcvtq_s32_f32(vmulq_f32(hi, gains1))));
+}
+
+#endif
+
+static inline int32_t _malGainClamp(float value, int32_t min, int32_t max) {
+    int32_t i = (int32_t)lrintf(value);
+    return i < min ? min : (i > max ? max : i);
+}
+
+/**
+ Multiplies interleaved samples by a gain that ramps linearly from `gain` to `targetGain` over
+ the samples, so that gain changes don't cause zipper noise. 8-bit samples are unsigned, and
+ 24-bit samples are packed.
+ */
+static void _malApplyGain(void *data, MalFormat format, uint32_t numSamples, float gain,
+                          float targetGain) {
+    if (numSamples == 0 || (gain == 1.0f && targetGain == 1.0f)) {
+        return;
+    }
+    const float step = (targetGain - gain) / (float)numSamples;
+    uint32_t i = 0;
+#if defined(MAL_SIMD_SSE2)
+    __m128 gains = _mm_add_ps(_mm_set1_ps(gain),
+                              _mm_mul_ps(_mm_set1_ps(step), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+    const __m128 gainStep = _mm_set1_ps(step * 4.0f);
+#elif defined(MAL_SIMD_NEON)
+    const float initialGains[4] = { gain, gain + step, gain + step * 2.0f, gain + step * 3.0f };
+    float32x4_t gains = vld1q_f32(initialGains);
+    const float32x4_t gainStep = vdupq_n_f32(step * 4.0f);
+#endif
+
+    if (format.isFloat) {
+        float *samples = (float *)data;
+#if defined(MAL_SIMD_SSE2)
+        for (; i + 4 <= numSamples; i += 4) {
+            _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gains));
+            gains = _mm_add_ps(gains, gainStep);
+        }
+#elif defined(MAL_SIMD_NEON)
+        for (; i + 4 <= numSamples; i += 4) {
+            vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), gains));
+            gains = vaddq_f32(gains, gainStep);
+        }
+#endif
+        for (; i < numSamples; i++) {
+            samples[i] *= gain + step * (float)i;
+        }
+    } else if (format.bitDepth == 8) {
+        uint8_t *samples = (uint8_t *)data;
+#if defined(MAL_SIMD_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi16(128);
+        for (; i + 16 <= numSamples; i += 16) {
+            __m128 gains1 = _mm_add_ps(gains, gainStep);
+            __m128 gains2 = _mm_add_ps(gains1, gainStep);
+            __m128 gains3 = _mm_add_ps(gains2, gainStep);
+            __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), bias);
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(x, zero), bias);
+            lo = _mm_adds_epi16(_malGainApplyInt16x8(lo, gains, gains1), bias);
+            hi = _mm_adds_epi16(_malGainApplyInt16x8(hi, gains2, gains3), bias);
+            _mm_storeu_si128((__m128i *)(samples + i), _mm_packus_epi16(lo, hi));
+            gains = _mm_add_ps(gains3, gainStep);
+        }
+#elif defined(MAL_SIMD_NEON)
+        const int16x8_t bias = vdupq_n_s16(128);
+        for (; i + 16 <= numSamples; i += 16) {
+            float32x4_t gains1 = vaddq_f32(gains, gainStep);
+            float32x4_t gains2 = vaddq_f32(gains1, gainStep);
+            float32x4_t gains3 = vaddq_f32(gains2, gainStep);
+            uint8x16_t x = vld1q_u8(samples + i);
+            int16x8_t lo = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(x))), bias);
+            int16x8_t hi = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(x))), bias);
+            lo = vqaddq_s16(_malGainApplyInt16x8(lo, gains, gains1), bias);
+            hi = vqaddq_s16(_malGainApplyInt16x8(hi, gains2, gains3), bias);
+            vst1q_u8(samples + i, vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+            gains = vaddq_f32(gains3, gainStep);
+        }
+#endif
+        for (; i < numSamples; i++) {
+            float value = (float)(samples[i] - 128) * (gain + step * (float)i);
+            samples[i] = (uint8_t)(_malGainClamp(value, -128, 127) + 128);
+        }
+    } else if (format.bitDepth == 16) {
+        int16_t *samples = (int16_t *)data;
+#if defined(MAL_SIMD_SSE2)
+        for (; i + 8 <= numSamples; i += 8) {
+            __m128 gains1 = _mm_add_ps(gains, gainStep);
+            __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+            _mm_storeu_si128((__m128i *)(samples + i), _malGainApplyInt16x8(x, gains, gains1));
+            gains = _mm_add_ps(gains1, gainStep);
+        }
+#elif defined(MAL_SIMD_NEON)
+        for (; i + 8 <= numSamples; i += 8) {
+            float32x4_t gains1 = vaddq_f32(gains, gainStep);
+            vst1q_s16(samples + i, _malGainApplyInt16x8(vld1q_s16(samples + i), gains, gains1));
+            gains = vaddq_f32(gains1, gainStep);
+        }
+#endif
+        for (; i < numSamples; i++) {
+            float value = (float)samples[i] * (gain + step * (float)i);
+            samples[i] = (int16_t)_malGainClamp(value, INT16_MIN, INT16_MAX);
+        }
+    } else if (format.bitDepth == 24) {
+        // Packed samples don't line up with vector lanes
+        uint8_t *samples = (uint8_t *)data;
+        for (; i < numSamples; i++) {
+            float value = (float)_malGetInt24(samples + i * 3) * (gain + step * (float)i);
+            _malSetInt24(samples + i * 3, _malGainClamp(value, -8388608, 8388607));
+        }
+    } else if (format.bitDepth == 32) {
+        int32_t *samples = (int32_t *)data;
+#if defined(MAL_SIMD_SSE2)
+        // Converting out-of-range floats gives INT32_MIN, so clamp first. 2147483520 is the
+        // largest float below 2^31.
+        const __m128 minValue = _mm_set1_ps(-2147483648.0f);
+        const __m128 maxValue = _mm_set1_ps(2147483520.0f);
+        for (; i + 4 <= numSamples; i += 4) {
+            __m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(samples + i)));
+            x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(x, gains), minValue), maxValue);
+            _mm_storeu_si128((__m128i *)(samples + i), _mm_cvtps_epi32(x));
+            gains = _mm_add_ps(gains, gainStep);
+        }
+#elif defined(MAL_SIMD_NEON)
+        for (; i + 4 <= numSamples; i += 4) {
+            float32x4_t x = vcvtq_f32_s32(vld1q_s32(samples + i));
+            vst1q_s32(samples + i, vcvtq_s32_f32(vmulq_f32(x, gains)));
+            gains = vaddq_f32(gains, gainStep);
+        }
+#endif
+        for (; i < numSamples; i++) {
+            double value = (double)samples[i] * (double)(gain + step * (float)i);
+            value = value < -2147483648.0 ? -2147483648.0 : (value > 2147483647.0 ?
+                                                            2147483647.0 : value);
+            samples[i] = (int32_t)lrint(value);
+        }
+    }
+}
+
+#endif
+
 #endif
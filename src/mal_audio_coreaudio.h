@@ -83,15 +83,18 @@ struct _MalPlayer {
     AUNode converterNode;
     uint32_t mixerBus;
 
-    _Atomic(float) totalGain;
+    _Atomic(float) muteGain; // 0 if muted, otherwise 1. The player's gain is in its fade.
     struct MalPlayerCallbackContext *callbackContext;
 
     // Only accessed on the render thread
     uint32_t nextFrame;
     struct MalRamp ramp;
+    float renderVolume; // The mixer input bus volume, set by the fade, mute, and ramps
 };
 
+#define MAL_USE_DEFAULT_FORMAT_IMPL
 #define MAL_USE_DEFAULT_BUFFER_IMPL
+#define MAL_INCLUDE_FADE_FUNCTIONS
 #include "mal_audio_abstract.h"
 
 static void _malContextSetSampleRate(MalContext *context);
@@ -131,6 +134,28 @@ static bool _malRamp(MalContext *context, AudioUnitScope scope, AudioUnitElement
     return done;
 }
 
+// Ramps the gain of a mixer input bus from `startGain` to `endGain` over `inFrames`, or sets it to
+// `endGain` if the mixer can't ramp input gain. Called on the render thread.
+static void _malRampInputGain(MalContext *context, AudioUnitElement bus, uint32_t inFrames,
+                              float startGain, float endGain) {
+    if (context->data.canRampInputGain) {
+        AudioUnitParameterEvent rampEvent;
+        memset(&rampEvent, 0, sizeof(rampEvent));
+        rampEvent.scope = kAudioUnitScope_Input;
+        rampEvent.element = bus;
+        rampEvent.parameter = kMultiChannelMixerParam_Volume;
+        rampEvent.eventType = kParameterEvent_Ramped;
+        rampEvent.eventValues.ramp.startValue = startGain;
+        rampEvent.eventValues.ramp.endValue = endGain;
+        rampEvent.eventValues.ramp.durationInFrames = inFrames;
+        rampEvent.eventValues.ramp.startBufferOffset = 0;
+        AudioUnitScheduleParameters(context->data.mixerUnit, &rampEvent, 1);
+    } else {
+        AudioUnitSetParameter(context->data.mixerUnit, kMultiChannelMixerParam_Volume,
+                              kAudioUnitScope_Input, bus, endGain, 0);
+    }
+}
+
 static OSStatus _malAudioUnitSetFormat(const MalContext *context, AudioUnit audioUnit,
                                        AudioUnitScope scope, uint32_t bus, MalFormat format) {
     double sampleRate = (format.sampleRate <= MAL_DEFAULT_SAMPLE_RATE ?
@@ -407,6 +432,45 @@ static void _malContextUpdateGain(MalContext *context) {
     }
 }
 
+static bool _malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer) {
+    (void)context;
+    (void)numFrames;
+    (void)outBuffer;
+    // Not supported: the audio system renders on its own thread
+    return false;
+}
+
+static bool _malContextGetTime(MalContext *context, double *time) {
+    (void)context;
+    (void)time;
+    // Not supported
+    return false;
+}
+
+static void _malContextCommitBatch(MalContext *context) {
+    (void)context;
+    // Do nothing. Changes are applied immediately.
+}
+
+static void _malContextPollEvents(MalContext *context) {
+    (void)context;
+    // Do nothing
+}
+
+static bool _malContextPrewarm(MalContext *context, MalFormat format, uint32_t count) {
+    (void)context;
+    (void)format;
+    (void)count;
+    // Not supported
+    return false;
+}
+
+static uint32_t _malContextGetNumAudioSystemStreams(const MalContext *context) {
+    (void)context;
+    // Not supported
+    return 0;
+}
+
 static OSStatus _malRenderNotification(void *userData, AudioUnitRenderActionFlags *flags,
                                        const AudioTimeStamp *timestamp, UInt32 bus,
                                        UInt32 inFrames, AudioBufferList *data) {
@@ -530,6 +594,7 @@ static OSStatus _malPlayerRenderCallback(void *userData, AudioUnitRenderActionFl
     }
     MalBuffer *buffer = player->buffer;
     MalStreamState streamState = atomic_load(&player->streamState);
+    bool didStart = false;
     if ((buffer == NULL || buffer->managedData == NULL) && streamState != MAL_STREAM_STOPPED) {
         if (streamState != MAL_STREAM_STOPPING) {
             if (!atomic_compare_exchange_strong(&player->streamState, &streamState,
@@ -541,6 +606,8 @@ static OSStatus _malPlayerRenderCallback(void *userData, AudioUnitRenderActionFl
         }
     } else if (streamState == MAL_STREAM_STARTING) {
         player->data.nextFrame = 0;
+        _malFadeDidStart(&player->fade);
+        didStart = true;
         if (atomic_compare_exchange_strong(&player->streamState, &streamState,
                                            MAL_STREAM_PLAYING)) {
             streamState = MAL_STREAM_PLAYING;
@@ -585,8 +652,7 @@ static OSStatus _malPlayerRenderCallback(void *userData, AudioUnitRenderActionFl
                                            MAL_STREAM_STOPPED)) {
             _malPlayerDisconnect(player);
             if (atomic_load(&player->hasOnFinishedCallback) && isPlaying) {
-                malPlayerRetain(player);
-                ok_queue_push(&player->context->finishedPlayersWithCallbacks, player);
+                _malContextQueueFinishedPlayer(player->context, player);
             }
         }
     } else {
@@ -629,10 +695,57 @@ static OSStatus _malPlayerRenderCallback(void *userData, AudioUnitRenderActionFl
                 memset(dst, 0, dstRemaining);
             }
         }
+        const float muteGain = atomic_load(&player->data.muteGain);
+        if (streamState == MAL_STREAM_PLAYING) {
+            // Fade. The pause and resume ramps take precedence.
+            double sampleRate = (buffer->format.sampleRate <= MAL_DEFAULT_SAMPLE_RATE ?
+                                 malContextGetSampleRate(player->context) :
+                                 buffer->format.sampleRate);
+            float fadeStartGain;
+            float fadeEndGain;
+            bool stopWhenFaded;
+            uint32_t fadeFrames = _malFadeNext(&player->fade, inFrames, sampleRate,
+                                               &fadeStartGain, &fadeEndGain, &stopWhenFaded);
+            if (player->data.ramp.type == MAL_RAMP_NONE) {
+                float startVolume = muteGain * fadeStartGain;
+                const float endVolume = muteGain * fadeEndGain;
+                if (didStart) {
+                    AudioUnitSetParameter(player->context->data.mixerUnit,
+                                          kMultiChannelMixerParam_Volume, kAudioUnitScope_Input,
+                                          player->data.mixerBus, startVolume, 0);
+                } else {
+                    // If the mute changed, ramp from the current volume
+                    startVolume = player->data.renderVolume;
+                }
+                if (startVolume != endVolume) {
+                    _malRampInputGain(player->context, player->data.mixerBus, fadeFrames,
+                                      startVolume, endVolume);
+                }
+                player->data.renderVolume = endVolume;
+            }
+            if (stopWhenFaded) {
+                for (uint32_t i = 0; i < data->mNumberBuffers; i++) {
+                    uint8_t *dst = data->mBuffers[i].mData;
+                    uint32_t offset = fadeFrames * frameSize;
+                    if (offset < data->mBuffers[i].mDataByteSize) {
+                        memset(dst + offset, 0, data->mBuffers[i].mDataByteSize - offset);
+                    }
+                }
+                if (atomic_compare_exchange_strong(&player->streamState, &streamState,
+                                                   MAL_STREAM_STOPPED)) {
+                    _malPlayerDisconnect(player);
+                    if (atomic_load(&player->hasOnFinishedCallback)) {
+                        _malContextQueueFinishedPlayer(player->context, player);
+                    }
+                }
+            }
+        }
         if (player->data.ramp.type != MAL_RAMP_NONE) {
+            const float rampEndVolume = (player->data.ramp.type == MAL_RAMP_FADE_OUT ? 0.0f :
+                                         muteGain * player->fade.gain);
             bool done = _malRamp(player->context, kAudioUnitScope_Input, player->data.mixerBus,
-                                 inFrames, atomic_load(&player->data.totalGain),
-                                 &player->data.ramp);
+                                 inFrames, muteGain * player->fade.gain, &player->data.ramp);
+            player->data.renderVolume = rampEndVolume;
             if (done && streamState == MAL_STREAM_PAUSED) {
                 _malPlayerDisconnect(player);
             }
@@ -801,26 +914,31 @@ static bool _malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer) {
     }
 }
 
+static bool _malPlayerSetStream(MalPlayer *player, MalStream *stream) {
+    (void)player;
+    (void)stream;
+    // Not supported
+    return false;
+}
+
 static void _malPlayerUpdateMute(MalPlayer *player) {
     _malPlayerUpdateGain(player);
 }
 
 static void _malPlayerUpdateGain(MalPlayer *player) {
-    if (player && player->context && player->context->data.mixerUnit) {
-        float totalGain = player->mute ? 0.0f : player->gain;
-        atomic_store(&player->data.totalGain, totalGain);
-        OSStatus status = AudioUnitSetParameter(player->context->data.mixerUnit,
-                                                kMultiChannelMixerParam_Volume,
-                                                kAudioUnitScope_Input,
-                                                player->data.mixerBus,
-                                                totalGain,
-                                                0);
-        if (status != noErr) {
-            MAL_LOG("Couldn't set volume (err %i)", (int)status);
-        }
+    // Applied with the fade in the render callback. The player's gain is posted to the fade by
+    // malPlayerSetGain().
+    if (player) {
+        atomic_store(&player->data.muteGain, player->mute ? 0.0f : 1.0f);
     }
 }
 
+static bool _malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded) {
+    // Evaluated in the render callback
+    _malFadePost(&player->fade, gain, duration, stopWhenFaded);
+    return true;
+}
+
 static bool _malPlayerSetLooping(MalPlayer *player, bool looping) {
     (void)player;
     (void)looping;
@@ -881,4 +999,25 @@ static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
     }
 }
 
+static bool _malPlayerPlayAt(MalPlayer *player, uint64_t startFrame) {
+    (void)player;
+    (void)startFrame;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerSetTargetLatency(MalPlayer *player, double latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerGetLatency(MalPlayer *player, double *latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
 #endif
@@ -0,0 +1,289 @@
+/*
+ Mal
+ https://github.com/brackeen/mal
+ Copyright (c) 2014-2018 David Brackeen
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MAL_AUDIO_NULL_H
+#define MAL_AUDIO_NULL_H
+
+// The null audio system doesn't output sound. Audio is rendered on demand with
+// malContextRender(), which is useful for offline rendering and for running on machines without
+// a sound server.
+
+#include "ok_lib.h"
+#include "mal.h"
+
+struct _MalContext {
+    // Held while rendering, and while the players or their buffers or streams change.
+    OK_LOCK_TYPE lock;
+    struct ok_vec_of(MalPlayer *) players;
+    // The audio clock: the number of frames rendered while active
+    uint64_t frameTime;
+};
+
+struct _MalBuffer {
+    int dummy;
+};
+
+struct _MalPlayer {
+    bool attached;
+    _Atomic(float) totalGain; // The context gain and mute. The player's gain is in its fade.
+};
+
+#define MAL_USE_DEFAULT_BUFFER_IMPL
+#define MAL_INCLUDE_MIXER_FUNCTIONS
+#define MAL_INCLUDE_FADE_FUNCTIONS
+#define MAL_RENDERS_ADPCM_BUFFERS
+#include "mal_audio_abstract.h"
+
+static const uint8_t MAL_NULL_NUM_CHANNELS = 2;
+
+// MARK: Context
+
+static bool _malContextInit(MalContext *context, void *androidActivity,
+                            const char **errorMissingAudioSystem) {
+    (void)androidActivity;
+    (void)errorMissingAudioSystem;
+    ok_vec_init(&context->data.players);
+    context->actualSampleRate = context->requestedSampleRate;
+    return true;
+}
+
+static void _malContextDispose(MalContext *context) {
+    ok_vec_deinit(&context->data.players);
+    ok_vec_init(&context->data.players);
+}
+
+static bool _malContextSetActive(MalContext *context, bool active) {
+    (void)context;
+    (void)active;
+    // Do nothing. Inactive contexts render silence.
+    return true;
+}
+
+static void _malContextUpdateMute(MalContext *context) {
+    ok_vec_apply(&context->players, _malPlayerUpdateMute);
+}
+
+static void _malContextUpdateGain(MalContext *context) {
+    ok_vec_apply(&context->players, _malPlayerUpdateGain);
+}
+
+static bool _malContextIsFormatValid(const MalContext *context, MalFormat format) {
+    (void)context;
+    if (format.numChannels == 0 || format.numChannels > MAL_MAX_CHANNELS) {
+        return false;
+    } else if (format.isFloat) {
+        return format.bitDepth == 32;
+    } else {
+        return (format.bitDepth == 8 || format.bitDepth == 16 || format.bitDepth == 24 ||
+                format.bitDepth == 32);
+    }
+}
+
+static bool _malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer) {
+    struct _MalContext *data = &context->data;
+    const uint64_t startMicros = _malGetMicroseconds();
+    const double sampleRate = malContextGetSampleRate(context);
+    const size_t length = sizeof(float) * MAL_NULL_NUM_CHANNELS * numFrames;
+    memset(outBuffer, 0, length);
+    if (context->active) {
+        OK_LOCK(&data->lock);
+        ok_vec_foreach(&data->players, MalPlayer *player) {
+            _malMixerRenderPlayer(player, player->buffer, player->stream, outBuffer, numFrames,
+                                  MAL_NULL_NUM_CHANNELS, sampleRate,
+                                  atomic_load(&player->data.totalGain), data->frameTime);
+        }
+        data->frameTime += numFrames;
+        OK_UNLOCK(&data->lock);
+    }
+    _malRenderCountersAddCallback(&context->renderCounters, startMicros, length, length, length);
+    return true;
+}
+
+static bool _malContextGetTime(MalContext *context, double *time) {
+    struct _MalContext *data = &context->data;
+    OK_LOCK(&data->lock);
+    uint64_t frameTime = data->frameTime;
+    OK_UNLOCK(&data->lock);
+    *time = (double)frameTime / malContextGetSampleRate(context);
+    return true;
+}
+
+static void _malContextCommitBatch(MalContext *context) {
+    (void)context;
+    // Do nothing. Changes are applied immediately.
+}
+
+static void _malContextPollEvents(MalContext *context) {
+    (void)context;
+    // Do nothing
+}
+
+static bool _malContextPrewarm(MalContext *context, MalFormat format, uint32_t count) {
+    (void)context;
+    (void)format;
+    (void)count;
+    // Not supported
+    return false;
+}
+
+static uint32_t _malContextGetNumAudioSystemStreams(const MalContext *context) {
+    (void)context;
+    // Not supported
+    return 0;
+}
+
+// MARK: Player
+
+static bool _malPlayerInit(MalPlayer *player, MalFormat format) {
+    (void)format;
+    if (!player->context) {
+        return false;
+    }
+    if (!player->data.attached) {
+        struct _MalContext *data = &player->context->data;
+        OK_LOCK(&data->lock);
+        ok_vec_push(&data->players, player);
+        player->data.attached = true;
+        OK_UNLOCK(&data->lock);
+    }
+    _malPlayerUpdateGain(player);
+    return true;
+}
+
+static void _malPlayerDispose(MalPlayer *player) {
+    if (player->context && player->data.attached) {
+        struct _MalContext *data = &player->context->data;
+        OK_LOCK(&data->lock);
+        ok_vec_remove(&data->players, player);
+        player->data.attached = false;
+        OK_UNLOCK(&data->lock);
+    }
+}
+
+static bool _malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer) {
+    if (player->context) {
+        OK_LOCK(&player->context->data.lock);
+        player->buffer = buffer;
+        OK_UNLOCK(&player->context->data.lock);
+    } else {
+        player->buffer = buffer;
+    }
+    return true;
+}
+
+static bool _malPlayerSetStream(MalPlayer *player, MalStream *stream) {
+    if (player->context) {
+        OK_LOCK(&player->context->data.lock);
+        player->stream = stream;
+        OK_UNLOCK(&player->context->data.lock);
+    } else {
+        player->stream = stream;
+    }
+    return true;
+}
+
+static void _malPlayerUpdateMute(MalPlayer *player) {
+    _malPlayerUpdateGain(player);
+}
+
+static void _malPlayerUpdateGain(MalPlayer *player) {
+    if (player && player->context) {
+        bool mute = player->context->mute || player->mute;
+        atomic_store(&player->data.totalGain, mute ? 0.0f : player->context->gain);
+    }
+}
+
+static bool _malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded) {
+    // Evaluated by the mixer
+    _malFadePost(&player->fade, gain, duration, stopWhenFaded);
+    return true;
+}
+
+static bool _malPlayerSetLooping(MalPlayer *player, bool looping) {
+    (void)player;
+    (void)looping;
+    // Do nothing
+    return true;
+}
+
+static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
+    if (!player->context || !player->data.attached) {
+        return false;
+    }
+
+    while (1) {
+        MalStreamState streamState = atomic_load(&player->streamState);
+        MalPlayerState oldState = _malStreamStateToPlayerState(streamState);
+        if (oldState == state) {
+            return true;
+        } else if (state == MAL_PLAYER_STATE_PAUSED) {
+            // Pause isn't possible if stopped (or stopping)
+            if (streamState == MAL_STREAM_STOPPING || streamState == MAL_STREAM_STOPPED ||
+                streamState == MAL_STREAM_DRAINING) {
+                return false;
+            }
+        }
+
+        MalStreamState newStreamState;
+        if (state == MAL_PLAYER_STATE_PLAYING) {
+            if (oldState == MAL_PLAYER_STATE_PAUSED) {
+                newStreamState = MAL_STREAM_RESUMING;
+            } else {
+                newStreamState = MAL_STREAM_STARTING;
+            }
+        } else if (state == MAL_PLAYER_STATE_PAUSED) {
+            if (streamState == MAL_STREAM_STARTING) {
+                // Hasn't started yet
+                newStreamState = MAL_STREAM_STOPPED;
+            } else {
+                newStreamState = MAL_STREAM_PAUSED;
+            }
+        } else {
+            newStreamState = MAL_STREAM_STOPPED;
+        }
+
+        if (atomic_compare_exchange_strong(&player->streamState, &streamState, newStreamState)) {
+            // The new state is picked up on the next render
+            return true;
+        }
+    }
+}
+
+static bool _malPlayerPlayAt(MalPlayer *player, uint64_t startFrame) {
+    player->startFrame = startFrame;
+    return _malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING);
+}
+
+static bool _malPlayerSetTargetLatency(MalPlayer *player, double latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerGetLatency(MalPlayer *player, double *latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
+#endif
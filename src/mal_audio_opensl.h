@@ -63,9 +63,18 @@ struct _MalPlayer {
 
     OK_LOCK_TYPE lock;
     bool backgroundPaused;
+
+    // Fades are evaluated in a play position callback, registered on the first fade. After that,
+    // the callback owns the volume level.
+    bool fadeCallbackRegistered;
+    _Atomic(float) contextGain;
+    float renderVolume; // The volume last set by the fade callback
+    double sampleRate;
 };
 
+#define MAL_USE_DEFAULT_FORMAT_IMPL
 #define MAL_USE_DEFAULT_BUFFER_IMPL
+#define MAL_INCLUDE_FADE_FUNCTIONS
 #include "mal_audio_abstract.h"
 #include <math.h>
 
@@ -201,6 +210,45 @@ static void _malContextUpdateGain(MalContext *context) {
     ok_vec_apply(&context->players, _malPlayerUpdateGain);
 }
 
+static bool _malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer) {
+    (void)context;
+    (void)numFrames;
+    (void)outBuffer;
+    // Not supported: the audio system renders on its own thread
+    return false;
+}
+
+static bool _malContextGetTime(MalContext *context, double *time) {
+    (void)context;
+    (void)time;
+    // Not supported
+    return false;
+}
+
+static void _malContextCommitBatch(MalContext *context) {
+    (void)context;
+    // Do nothing. Changes are applied immediately.
+}
+
+static void _malContextPollEvents(MalContext *context) {
+    (void)context;
+    // Do nothing
+}
+
+static bool _malContextPrewarm(MalContext *context, MalFormat format, uint32_t count) {
+    (void)context;
+    (void)format;
+    (void)count;
+    // Not supported
+    return false;
+}
+
+static uint32_t _malContextGetNumAudioSystemStreams(const MalContext *context) {
+    (void)context;
+    // Not supported
+    return 0;
+}
+
 // MARK: Player
 
 // Buffer queue callback, which is called on a different thread.
@@ -226,8 +274,7 @@ static void _malPlayerRenderCallback(SLBufferQueueItf queue, void *voidPlayer) {
             if (atomic_compare_exchange_strong(&player->streamState, &expectedState,
                                                MAL_STREAM_STOPPED) &&
                 atomic_load(&player->hasOnFinishedCallback) && player->context) {
-                malPlayerRetain(player);
-                ok_queue_push(&player->context->finishedPlayersWithCallbacks, player);
+                _malContextQueueFinishedPlayer(player->context, player);
             }
         }
         OK_UNLOCK(&player->data.lock);
@@ -242,17 +289,86 @@ static void _malPlayerUpdateMute(MalPlayer *player) {
     }
 }
 
+static void _malPlayerSetVolumeLevel(MalPlayer *player, float gain) {
+    SLmillibel millibelVolume = (SLmillibel)lroundf(2000 * log10f(gain));
+    if (millibelVolume < SL_MILLIBEL_MIN) {
+        millibelVolume = SL_MILLIBEL_MIN;
+    } else if (millibelVolume > 0) {
+        millibelVolume = 0;
+    }
+    (*player->data.slVolume)->SetVolumeLevel(player->data.slVolume, millibelVolume);
+}
+
 static void _malPlayerUpdateGain(MalPlayer *player) {
     if (player && player->context && player->data.slVolume) {
-        float gain = player->context->gain * player->gain;
-        SLmillibel millibelVolume = (SLmillibel)lroundf(2000 * log10f(gain));
-        if (millibelVolume < SL_MILLIBEL_MIN) {
-            millibelVolume = SL_MILLIBEL_MIN;
-        } else if (millibelVolume > 0) {
-            millibelVolume = 0;
+        atomic_store(&player->data.contextGain, player->context->gain);
+        if (!player->data.fadeCallbackRegistered) {
+            _malPlayerSetVolumeLevel(player, player->context->gain * player->gain);
+        }
+        // Otherwise, applied with the fade in the next play position callback
+    }
+}
+
+#define MAL_OPENSL_FADE_PERIOD_MILLIS 10
+
+// Play position callback, which is called on a different thread every
+// MAL_OPENSL_FADE_PERIOD_MILLIS while playing. Evaluates the player's fade for one period.
+static void _malPlayerFadeCallback(SLPlayItf play, void *voidPlayer, SLuint32 event) {
+    (void)play;
+    MalPlayer *player = (MalPlayer *)voidPlayer;
+    if (!player || event != SL_PLAYEVENT_HEADATNEWPOS || !player->data.slVolume ||
+        atomic_load(&player->streamState) != MAL_STREAM_PLAYING) {
+        return;
+    }
+    const uint32_t periodFrames = (uint32_t)(player->data.sampleRate *
+                                             MAL_OPENSL_FADE_PERIOD_MILLIS / 1000.0 + 0.5);
+    bool stop;
+    const float gain = _malFadeAdvance(&player->fade, periodFrames, player->data.sampleRate,
+                                       &stop);
+    const float volume = atomic_load(&player->data.contextGain) * gain;
+    if (volume != player->data.renderVolume) {
+        player->data.renderVolume = volume;
+        _malPlayerSetVolumeLevel(player, volume);
+    }
+    MalStreamState expectedState = MAL_STREAM_PLAYING;
+    if (stop && atomic_compare_exchange_strong(&player->streamState, &expectedState,
+                                               MAL_STREAM_STOPPED)) {
+        (*player->data.slPlay)->SetPlayState(player->data.slPlay, SL_PLAYSTATE_STOPPED);
+        (*player->data.slBufferQueue)->Clear(player->data.slBufferQueue);
+        if (atomic_load(&player->hasOnFinishedCallback) && player->context) {
+            _malContextQueueFinishedPlayer(player->context, player);
+        }
+    }
+}
+
+static bool _malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded) {
+    if (!player->data.slPlay || !player->data.slVolume) {
+        return false;
+    }
+    if (!player->data.fadeCallbackRegistered) {
+        // The callback isn't running yet, so its state can be set here. It starts at the volume
+        // set by _malPlayerUpdateGain().
+        player->fade.gain = player->gain;
+        player->fade.targetGain = player->gain;
+        player->fade.remainingFrames = 0;
+        player->fade.renderSerial = atomic_load(&player->fade.serial);
+        player->data.renderVolume = atomic_load(&player->data.contextGain) * player->gain;
+        SLPlayItf slPlay = player->data.slPlay;
+        SLresult result = (*slPlay)->SetPositionUpdatePeriod(slPlay,
+                                                             MAL_OPENSL_FADE_PERIOD_MILLIS);
+        if (result == SL_RESULT_SUCCESS) {
+            result = (*slPlay)->RegisterCallback(slPlay, _malPlayerFadeCallback, player);
+        }
+        if (result == SL_RESULT_SUCCESS) {
+            result = (*slPlay)->SetCallbackEventsMask(slPlay, SL_PLAYEVENT_HEADATNEWPOS);
         }
-        (*player->data.slVolume)->SetVolumeLevel(player->data.slVolume, millibelVolume);
+        if (result != SL_RESULT_SUCCESS) {
+            return false;
+        }
+        player->data.fadeCallbackRegistered = true;
     }
+    _malFadePost(&player->fade, gain, duration, stopWhenFaded);
+    return true;
 }
 
 static bool _malPlayerInit(MalPlayer *player, MalFormat format) {
@@ -272,6 +388,7 @@ static bool _malPlayerInit(MalPlayer *player, MalFormat format) {
 
     double sampleRate = (format.sampleRate <= MAL_DEFAULT_SAMPLE_RATE ?
                          malContextGetSampleRate(player->context) : format.sampleRate);
+    player->data.sampleRate = sampleRate;
 
     SLDataFormat_PCM slFormat = {
         .formatType = SL_DATAFORMAT_PCM,
@@ -354,6 +471,7 @@ static void _malPlayerDispose(MalPlayer *player) {
         player->data.slBufferQueue = NULL;
         player->data.slPlay = NULL;
         player->data.slVolume = NULL;
+        player->data.fadeCallbackRegistered = false;
     }
 }
 
@@ -364,6 +482,13 @@ static bool _malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer) {
     return true;
 }
 
+static bool _malPlayerSetStream(MalPlayer *player, MalStream *stream) {
+    (void)player;
+    (void)stream;
+    // Not supported
+    return false;
+}
+
 static bool _malPlayerSetLooping(MalPlayer *player, bool looping) {
     (void)player;
     (void)looping;
@@ -432,4 +557,25 @@ static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
     }
 }
 
+static bool _malPlayerPlayAt(MalPlayer *player, uint64_t startFrame) {
+    (void)player;
+    (void)startFrame;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerSetTargetLatency(MalPlayer *player, double latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerGetLatency(MalPlayer *player, double *latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
 #endif
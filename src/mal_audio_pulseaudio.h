@@ -22,6 +22,12 @@
 #ifndef MAL_AUDIO_PULSEAUDIO_H
 #define MAL_AUDIO_PULSEAUDIO_H
 
+// Options:
+// MAL_PULSEAUDIO_STATIC: Link to libpulse instead of loading it at runtime.
+// MAL_PULSEAUDIO_ZERO_COPY: Pass buffer data to the server without copying it into the stream's
+// write buffer (requires PulseAudio 6.0). This avoids a copy when the connection doesn't use
+// shared memory; with shared memory, libpulse copies the data itself.
+
 #ifdef __clang__
 #  pragma clang diagnostic push
 #  pragma clang diagnostic ignored "-Weverything"
@@ -79,18 +85,29 @@ FUNC_DECLARE(pa_stream_new);
 FUNC_DECLARE(pa_stream_get_state);
 FUNC_DECLARE(pa_stream_get_sample_spec);
 FUNC_DECLARE(pa_stream_get_index);
+FUNC_DECLARE(pa_stream_get_time);
+FUNC_DECLARE(pa_stream_get_timing_info);
+FUNC_DECLARE(pa_stream_get_latency);
 FUNC_DECLARE(pa_stream_set_write_callback);
 FUNC_DECLARE(pa_stream_set_state_callback);
 FUNC_DECLARE(pa_stream_update_sample_rate);
+FUNC_DECLARE(pa_stream_set_buffer_attr);
 FUNC_DECLARE(pa_stream_connect_playback);
 FUNC_DECLARE(pa_stream_begin_write);
 FUNC_DECLARE(pa_stream_write);
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+FUNC_DECLARE(pa_stream_write_ext_free);
+#endif
+FUNC_DECLARE(pa_stream_writable_size);
 FUNC_DECLARE(pa_stream_cork);
+FUNC_DECLARE(pa_stream_flush);
 FUNC_DECLARE(pa_stream_set_underflow_callback);
 FUNC_DECLARE(pa_stream_disconnect);
 FUNC_DECLARE(pa_stream_unref);
 FUNC_DECLARE(pa_channel_map_init_auto);
+FUNC_DECLARE(pa_channel_map_init);
 FUNC_DECLARE(pa_sw_volume_from_linear);
+FUNC_DECLARE(pa_rtclock_now);
 
 #define pa_threaded_mainloop_new FUNC_PREFIX(pa_threaded_mainloop_new)
 #define pa_threaded_mainloop_free FUNC_PREFIX(pa_threaded_mainloop_free)
@@ -116,18 +133,29 @@ FUNC_DECLARE(pa_sw_volume_from_linear);
 #define pa_stream_get_state FUNC_PREFIX(pa_stream_get_state)
 #define pa_stream_get_sample_spec FUNC_PREFIX(pa_stream_get_sample_spec)
 #define pa_stream_get_index FUNC_PREFIX(pa_stream_get_index)
+#define pa_stream_get_time FUNC_PREFIX(pa_stream_get_time)
+#define pa_stream_get_timing_info FUNC_PREFIX(pa_stream_get_timing_info)
+#define pa_stream_get_latency FUNC_PREFIX(pa_stream_get_latency)
 #define pa_stream_set_write_callback FUNC_PREFIX(pa_stream_set_write_callback)
 #define pa_stream_set_state_callback FUNC_PREFIX(pa_stream_set_state_callback)
 #define pa_stream_update_sample_rate FUNC_PREFIX(pa_stream_update_sample_rate)
+#define pa_stream_set_buffer_attr FUNC_PREFIX(pa_stream_set_buffer_attr)
 #define pa_stream_connect_playback FUNC_PREFIX(pa_stream_connect_playback)
 #define pa_stream_begin_write FUNC_PREFIX(pa_stream_begin_write)
 #define pa_stream_write FUNC_PREFIX(pa_stream_write)
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+#define pa_stream_write_ext_free FUNC_PREFIX(pa_stream_write_ext_free)
+#endif
+#define pa_stream_writable_size FUNC_PREFIX(pa_stream_writable_size)
 #define pa_stream_cork FUNC_PREFIX(pa_stream_cork)
+#define pa_stream_flush FUNC_PREFIX(pa_stream_flush)
 #define pa_stream_set_underflow_callback FUNC_PREFIX(pa_stream_set_underflow_callback)
 #define pa_stream_disconnect FUNC_PREFIX(pa_stream_disconnect)
 #define pa_stream_unref FUNC_PREFIX(pa_stream_unref)
 #define pa_channel_map_init_auto FUNC_PREFIX(pa_channel_map_init_auto)
+#define pa_channel_map_init FUNC_PREFIX(pa_channel_map_init)
 #define pa_sw_volume_from_linear FUNC_PREFIX(pa_sw_volume_from_linear)
+#define pa_rtclock_now FUNC_PREFIX(pa_rtclock_now)
 
 static void *_malLoadSym(void *handle, const char *name) {
     dlerror();
@@ -178,18 +206,29 @@ static int _malLoadLibpulse() {
     FUNC_LOAD(handle, pa_stream_get_state);
     FUNC_LOAD(handle, pa_stream_get_sample_spec);
     FUNC_LOAD(handle, pa_stream_get_index);
+    FUNC_LOAD(handle, pa_stream_get_time);
+    FUNC_LOAD(handle, pa_stream_get_timing_info);
+    FUNC_LOAD(handle, pa_stream_get_latency);
     FUNC_LOAD(handle, pa_stream_set_write_callback);
     FUNC_LOAD(handle, pa_stream_set_state_callback);
     FUNC_LOAD(handle, pa_stream_update_sample_rate);
+    FUNC_LOAD(handle, pa_stream_set_buffer_attr);
     FUNC_LOAD(handle, pa_stream_connect_playback);
     FUNC_LOAD(handle, pa_stream_begin_write);
     FUNC_LOAD(handle, pa_stream_write);
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+    FUNC_LOAD(handle, pa_stream_write_ext_free);
+#endif
+    FUNC_LOAD(handle, pa_stream_writable_size);
     FUNC_LOAD(handle, pa_stream_cork);
+    FUNC_LOAD(handle, pa_stream_flush);
     FUNC_LOAD(handle, pa_stream_set_underflow_callback);
     FUNC_LOAD(handle, pa_stream_disconnect);
     FUNC_LOAD(handle, pa_stream_unref);
     FUNC_LOAD(handle, pa_channel_map_init_auto);
+    FUNC_LOAD(handle, pa_channel_map_init);
     FUNC_LOAD(handle, pa_sw_volume_from_linear);
+    FUNC_LOAD(handle, pa_rtclock_now);
 
     libpulseHandle = handle;
     return PA_OK;
@@ -205,9 +244,36 @@ fail:
 #include "ok_lib.h"
 #include "mal.h"
 
+// Ready, corked playback streams that aren't used by a player
+struct _MalStreamPool {
+    pa_sample_spec sampleSpec;
+    uint32_t maxStreams;
+    struct ok_vec_of(pa_stream *) streams;
+};
+
 struct _MalContext {
     pa_threaded_mainloop *mainloop;
     pa_context *context;
+
+    // Streams for new players, grouped by sample spec. See malContextPrewarm().
+    struct ok_vec_of(struct _MalStreamPool) streamPools;
+
+    // Software mixing. Players in `mixerPlayers` are only modified with the mainloop lock held.
+    pa_stream *mixerStream;
+    struct ok_vec_of(MalPlayer *) mixerPlayers;
+    uint64_t mixerFrameTime; // Frames written to the mixer stream
+
+    // The audio clock without software mixing
+    pa_usec_t clockStart;
+
+    // Players with changes to send to the server when the batch is committed
+    struct ok_vec_of(MalPlayer *) batchPlayers;
+
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+    // Buffers whose last reference was released by a zero-copy write. They are freed on the app
+    // thread.
+    struct ok_queue_of(MalBuffer *) releasedBuffers;
+#endif
 };
 
 struct _MalBuffer {
@@ -217,16 +283,70 @@ struct _MalBuffer {
 struct _MalPlayer {
     pa_stream *stream;
 
-    OK_LOCK_TYPE lock;
+    // The buffer and stream are published to the render thread without locking. The render
+    // thread marks the buffer and stream it is reading as in use; replaced ones are retained in
+    // `retiredBuffers` and `retiredStreams` until they are no longer in use.
+    _Atomic(MalBuffer *) renderBuffer;
+    _Atomic(MalBuffer *) renderBufferInUse;
+    _Atomic(MalStream *) renderStream;
+    _Atomic(MalStream *) renderStreamInUse;
+    struct ok_vec_of(MalBuffer *) retiredBuffers;
+    struct ok_vec_of(MalStream *) retiredStreams;
+
     bool backgroundPaused;
+    bool mixerAttached;
+    // With the mixer or software gain, the context gain and mute. The player's gain is in its fade.
+    _Atomic(float) totalGain;
+    // Set by the player's first fade, which moves its gain from the server to the render callback
+    _Atomic(bool) softwareFade;
+
+    // Changes deferred until the context's batch is committed
+    bool batched;
+    bool muteChanged;
+    bool gainChanged;
+    bool corkChanged;
+    int cork;
 
     // Only accessed on the render thread
     uint32_t nextFrame;
+    uint64_t startDelayFrames;
+    bool streamWritten;
+    float renderGain; // With software gain, the gain at the end of the last write
+    bool renderGainSet;
 };
 
 #define MAL_USE_DEFAULT_BUFFER_IMPL
+#define MAL_INCLUDE_MIXER_FUNCTIONS
+#define MAL_INCLUDE_GAIN_FUNCTIONS
+#define MAL_INCLUDE_FADE_FUNCTIONS
+#define MAL_RENDERS_ADPCM_BUFFERS
+#define MAL_CONNECTS_ASYNC
 #include "mal_audio_abstract.h"
 
+#if defined(MAL_TRACE)
+
+// Traces time spent waiting for the mainloop lock, and waiting for the mainloop to signal
+static void _malPulseAudioTracedLock(pa_threaded_mainloop *mainloop) {
+    MAL_TRACE_BEGIN("pa_threaded_mainloop_lock");
+    pa_threaded_mainloop_lock(mainloop);
+    MAL_TRACE_END("pa_threaded_mainloop_lock");
+}
+
+static void _malPulseAudioTracedWait(pa_threaded_mainloop *mainloop) {
+    MAL_TRACE_BEGIN("pa_threaded_mainloop_wait");
+    pa_threaded_mainloop_wait(mainloop);
+    MAL_TRACE_END("pa_threaded_mainloop_wait");
+}
+
+#undef pa_threaded_mainloop_lock
+#undef pa_threaded_mainloop_wait
+#define pa_threaded_mainloop_lock _malPulseAudioTracedLock
+#define pa_threaded_mainloop_wait _malPulseAudioTracedWait
+
+#endif
+
+static const uint8_t MAL_MIXER_NUM_CHANNELS = 2;
+
 // MARK: Context
 
 static void _malPulseAudioOperationWait(pa_threaded_mainloop *mainloop, pa_operation *operation) {
@@ -252,10 +372,510 @@ static void _malPulseAudioServerInfoCallback(pa_context *c, const pa_server_info
     pa_threaded_mainloop_signal(context->data.mainloop, 0);
 }
 
-static bool _malContextInit(MalContext *context, void *androidActivity,
-                            const char **errorMissingAudioSystem) {
-    (void)androidActivity;
+static void _malStreamStateCallback(pa_stream *stream, void *userData);
+static void _malPlayerSendMute(MalPlayer *player);
+static void _malPlayerSendGain(MalPlayer *player);
+
+/*
+ Sets the channel map for the speaker order documented for MalFormat. For 3 or more channels this
+ differs from PA_CHANNEL_MAP_WAVEEX, which assigns the first N positions of the WAVE channel mask
+ (so 4 channels would be FL, FR, FC, LFE).
+ */
+static bool _malPulseAudioInitChannelMap(pa_channel_map *channelMap, uint8_t channels) {
+    static const pa_channel_position_t positions[MAL_MAX_CHANNELS - 2][MAL_MAX_CHANNELS] = {
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_FRONT_CENTER },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_REAR_LEFT, PA_CHANNEL_POSITION_REAR_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_REAR_LEFT,
+          PA_CHANNEL_POSITION_REAR_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_LFE,
+          PA_CHANNEL_POSITION_REAR_LEFT, PA_CHANNEL_POSITION_REAR_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_LFE,
+          PA_CHANNEL_POSITION_REAR_CENTER, PA_CHANNEL_POSITION_SIDE_LEFT,
+          PA_CHANNEL_POSITION_SIDE_RIGHT },
+        { PA_CHANNEL_POSITION_FRONT_LEFT, PA_CHANNEL_POSITION_FRONT_RIGHT,
+          PA_CHANNEL_POSITION_FRONT_CENTER, PA_CHANNEL_POSITION_LFE,
+          PA_CHANNEL_POSITION_REAR_LEFT, PA_CHANNEL_POSITION_REAR_RIGHT,
+          PA_CHANNEL_POSITION_SIDE_LEFT, PA_CHANNEL_POSITION_SIDE_RIGHT },
+    };
+    if (channels <= 2) {
+        return pa_channel_map_init_auto(channelMap, channels, PA_CHANNEL_MAP_WAVEEX) != NULL;
+    } else if (channels > MAL_MAX_CHANNELS) {
+        return false;
+    }
+    pa_channel_map_init(channelMap);
+    channelMap->channels = channels;
+    for (uint8_t i = 0; i < channels; i++) {
+        channelMap->map[i] = positions[channels - 3][i];
+    }
+    return true;
+}
+
+// Creates a stream and starts connecting it, without waiting. The mainloop lock must be held.
+static pa_stream *_malPulseAudioConnectStream(struct _MalContext *pa, const char *name,
+                                              const pa_sample_spec *sampleSpec,
+                                              const pa_buffer_attr *bufferAttributes,
+                                              pa_stream_flags_t flags,
+                                              pa_stream_notify_cb_t stateCallback,
+                                              void *userData) {
+    pa_channel_map channelMap;
+    if (!_malPulseAudioInitChannelMap(&channelMap, sampleSpec->channels)) {
+        return NULL;
+    }
+
+    pa_stream *stream = pa_stream_new(pa->context, name, sampleSpec, &channelMap);
+    if (!stream) {
+        return NULL;
+    }
+
+    pa_stream_set_state_callback(stream, stateCallback, userData);
+    if (pa_stream_connect_playback(stream, NULL, bufferAttributes, flags, NULL, NULL) != PA_OK) {
+        pa_stream_set_state_callback(stream, NULL, NULL);
+        pa_stream_unref(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+// Waits for a stream created with _malPulseAudioConnectStream() (with the
+// _malStreamStateCallback() state callback) to be ready. If it fails, the stream is released and
+// NULL is returned. The mainloop lock must be held.
+static pa_stream *_malPulseAudioWaitForStream(struct _MalContext *pa, pa_stream *stream) {
+    if (!stream) {
+        return NULL;
+    }
+
+    pa_stream_state_t state;
+    while (1) {
+        state = pa_stream_get_state(stream);
+        if (state == PA_STREAM_READY || !PA_STREAM_IS_GOOD(state)) {
+            break;
+        }
+        pa_threaded_mainloop_wait(pa->mainloop);
+    }
+    pa_stream_set_state_callback(stream, NULL, NULL);
+
+    if (state != PA_STREAM_READY) {
+        pa_stream_unref(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+// Creates a stream and waits for PA_STREAM_READY. The mainloop lock must be held.
+static pa_stream *_malPulseAudioCreateStream(struct _MalContext *pa, const char *name,
+                                             const pa_sample_spec *sampleSpec,
+                                             const pa_buffer_attr *bufferAttributes,
+                                             pa_stream_flags_t flags) {
+    pa_stream *stream = _malPulseAudioConnectStream(pa, name, sampleSpec, bufferAttributes, flags,
+                                                    _malStreamStateCallback, pa->mainloop);
+    return _malPulseAudioWaitForStream(pa, stream);
+}
+
+static pa_sample_spec _malPulseAudioGetSampleSpec(MalContext *context, MalFormat format) {
+    const int n = 1;
+    const bool isLittleEndian = *(const char *)&n == 1;
+    double sampleRate = (format.sampleRate <= MAL_DEFAULT_SAMPLE_RATE ?
+                         malContextGetSampleRate(context) : format.sampleRate);
+
+    pa_sample_format_t sampleFormat;
+    if (format.isFloat) {
+        sampleFormat = PA_SAMPLE_FLOAT32NE;
+    } else {
+        switch (format.bitDepth) {
+            case 8:
+                sampleFormat = PA_SAMPLE_U8;
+                break;
+            case 16: default:
+                sampleFormat = isLittleEndian ? PA_SAMPLE_S16LE : PA_SAMPLE_S16BE;
+                break;
+            case 24:
+                sampleFormat = isLittleEndian ? PA_SAMPLE_S24LE : PA_SAMPLE_S24BE;
+                break;
+            case 32:
+                sampleFormat = isLittleEndian ? PA_SAMPLE_S32LE : PA_SAMPLE_S32BE;
+                break;
+        }
+    }
+
+    pa_sample_spec sampleSpec;
+    sampleSpec.format = sampleFormat;
+    sampleSpec.rate = (uint32_t)sampleRate;
+    sampleSpec.channels = format.numChannels;
+    return sampleSpec;
+}
+
+// Gets the target latency of player streams that don't override it
+static double _malContextGetPlayerLatency(const MalContext *context) {
+    return context->targetLatency > 0.0 ? context->targetLatency : 0.5;
+}
+
+static double _malPlayerGetTargetLatency(const MalPlayer *player) {
+    if (player->targetLatency > 0.0) {
+        return player->targetLatency;
+    } else {
+        return _malContextGetPlayerLatency(player->context);
+    }
+}
+
+static pa_buffer_attr _malPulseAudioGetPlayerBufferAttr(MalFormat format, uint32_t sampleRate,
+                                                        double latency) {
+    pa_buffer_attr bufferAttributes;
+    bufferAttributes.tlength = ((format.bitDepth / 8) * format.numChannels *
+                                (uint32_t)(latency * sampleRate));
+    bufferAttributes.maxlength = (uint32_t)-1;
+    bufferAttributes.minreq = (uint32_t)-1;
+    bufferAttributes.prebuf = 0;
+    bufferAttributes.fragsize = (uint32_t)-1;
+    return bufferAttributes;
+}
+
+// Creates a player stream and starts connecting it, without waiting. If `stateCallback` is
+// NULL, the _malStreamStateCallback() callback is used. The mainloop lock must be held.
+static pa_stream *_malPulseAudioConnectPlayerStream(struct _MalContext *pa, MalFormat format,
+                                                    const pa_sample_spec *sampleSpec,
+                                                    double latency,
+                                                    pa_stream_notify_cb_t stateCallback,
+                                                    void *userData) {
+    pa_buffer_attr bufferAttributes = _malPulseAudioGetPlayerBufferAttr(format, sampleSpec->rate,
+                                                                        latency);
+
+    int flags = (PA_STREAM_START_CORKED |       // Start paused
+                 PA_STREAM_ADJUST_LATENCY |     // Let server pick buffer metrics
+                 PA_STREAM_INTERPOLATE_TIMING | // For pa_stream_get_time()
+                 PA_STREAM_NOT_MONOTONIC |      // For pa_stream_get_time()
+                 PA_STREAM_AUTO_TIMING_UPDATE | // For pa_stream_get_time()
+                 PA_STREAM_VARIABLE_RATE);      // For pa_stream_update_sample_rate()
+
+    if (!stateCallback) {
+        stateCallback = _malStreamStateCallback;
+        userData = pa->mainloop;
+    }
+    return _malPulseAudioConnectStream(pa, "Playback Stream", sampleSpec, &bufferAttributes,
+                                       (pa_stream_flags_t)flags, stateCallback, userData);
+}
+
+// MARK: Stream pool
+
+static bool _malPulseAudioSampleSpecsEqual(const pa_sample_spec *a, const pa_sample_spec *b) {
+    return a->format == b->format && a->rate == b->rate && a->channels == b->channels;
+}
+
+static struct _MalStreamPool *_malContextGetStreamPool(struct _MalContext *pa,
+                                                       const pa_sample_spec *sampleSpec,
+                                                       bool create) {
+    ok_vec_foreach_ptr(&pa->streamPools, struct _MalStreamPool *pool) {
+        if (_malPulseAudioSampleSpecsEqual(&pool->sampleSpec, sampleSpec)) {
+            return pool;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    struct _MalStreamPool *pool = ok_vec_push_new(&pa->streamPools);
+    if (pool) {
+        pool->sampleSpec = *sampleSpec;
+        pool->maxStreams = 0;
+        ok_vec_init(&pool->streams);
+    }
+    return pool;
+}
+
+// Takes a ready stream from the pool, or returns NULL. The mainloop lock must be held.
+static pa_stream *_malContextTakePooledStream(struct _MalContext *pa,
+                                              const pa_sample_spec *sampleSpec) {
+    struct _MalStreamPool *pool = _malContextGetStreamPool(pa, sampleSpec, false);
+    while (pool && pool->streams.count > 0) {
+        pa_stream *stream = *ok_vec_last(&pool->streams);
+        ok_vec_remove_at(&pool->streams, pool->streams.count - 1);
+        if (pa_stream_get_state(stream) == PA_STREAM_READY) {
+            return stream;
+        }
+        // Disconnected by the server while in the pool
+        pa_stream_unref(stream);
+    }
+    return NULL;
+}
+
+// Returns a stream to the pool, if the pool has room for it. The stream is stopped and its
+// queued audio is discarded. The mainloop lock must be held.
+static bool _malContextReturnPooledStream(struct _MalContext *pa, pa_stream *stream) {
+    if (pa_stream_get_state(stream) != PA_STREAM_READY) {
+        return false;
+    }
+    struct _MalStreamPool *pool = _malContextGetStreamPool(pa, pa_stream_get_sample_spec(stream),
+                                                           false);
+    if (!pool || pool->streams.count >= pool->maxStreams) {
+        return false;
+    }
+    pa_operation_unref(pa_stream_cork(stream, 1, NULL, NULL));
+    pa_operation_unref(pa_stream_flush(stream, NULL, NULL));
+    ok_vec_push(&pool->streams, stream);
+    return true;
+}
+
+// Disconnects the pooled streams. The mainloop lock must be held.
+static void _malContextClearStreamPools(struct _MalContext *pa) {
+    ok_vec_foreach_ptr(&pa->streamPools, struct _MalStreamPool *pool) {
+        ok_vec_foreach(&pool->streams, pa_stream *stream) {
+            pa_stream_disconnect(stream);
+            pa_stream_unref(stream);
+        }
+        ok_vec_clear(&pool->streams);
+    }
+}
+
+// Gets the player's buffer and marks it as in use. Only called on the render thread.
+static MalBuffer *_malPlayerAcquireRenderBuffer(MalPlayer *player) {
+    MalBuffer *buffer = atomic_load(&player->data.renderBuffer);
+    while (1) {
+        atomic_store(&player->data.renderBufferInUse, buffer);
+        MalBuffer *currentBuffer = atomic_load(&player->data.renderBuffer);
+        if (currentBuffer == buffer) {
+            return buffer;
+        }
+        buffer = currentBuffer;
+    }
+}
+
+static void _malPlayerReleaseRenderBuffer(MalPlayer *player) {
+    atomic_store(&player->data.renderBufferInUse, NULL);
+}
+
+// Gets the player's stream and marks it as in use. Only called on the render thread.
+static MalStream *_malPlayerAcquireRenderStream(MalPlayer *player) {
+    MalStream *stream = atomic_load(&player->data.renderStream);
+    while (1) {
+        atomic_store(&player->data.renderStreamInUse, stream);
+        MalStream *currentStream = atomic_load(&player->data.renderStream);
+        if (currentStream == stream) {
+            return stream;
+        }
+        stream = currentStream;
+    }
+}
+
+static void _malPlayerReleaseRenderStream(MalPlayer *player) {
+    atomic_store(&player->data.renderStreamInUse, NULL);
+}
+
+// Releases replaced buffers and streams that the render thread no longer uses. If `all` is true,
+// the render thread must not be rendering this player.
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+
+// Called, from any thread, when the server no longer needs the data of a zero-copy write
+static void _malPulseAudioBufferWriteDidFinish(void *userData) {
+    MalBuffer *buffer = userData;
+    if (OK_ATOMIC_DEC(&buffer->refCount) == 0) {
+        MalContext *context = buffer->context;
+        if (context) {
+            ok_queue_push(&context->data.releasedBuffers, buffer);
+        } else {
+            // Detached from the context, so freeing doesn't touch shared state
+            _malBufferFree(buffer);
+        }
+    }
+}
+
+#endif
+
+// Frees buffers released by zero-copy writes. Only called on the app thread.
+static void _malContextFreeReleasedBuffers(MalContext *context) {
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+    MalBuffer *buffer = NULL;
+    while (ok_queue_pop(&context->data.releasedBuffers, &buffer)) {
+        _malBufferFree(buffer);
+    }
+#else
+    (void)context;
+#endif
+}
+
+static void _malPlayerReclaimBuffers(MalPlayer *player, bool all) {
+    if (player->context) {
+        _malContextFreeReleasedBuffers(player->context);
+    }
+    MalBuffer *bufferInUse = all ? NULL : atomic_load(&player->data.renderBufferInUse);
+    size_t i = 0;
+    while (i < player->data.retiredBuffers.count) {
+        MalBuffer *buffer = ok_vec_get(&player->data.retiredBuffers, i);
+        if (buffer == bufferInUse) {
+            i++;
+        } else {
+            ok_vec_remove_at(&player->data.retiredBuffers, i);
+            malBufferRelease(buffer);
+        }
+    }
+    MalStream *streamInUse = all ? NULL : atomic_load(&player->data.renderStreamInUse);
+    i = 0;
+    while (i < player->data.retiredStreams.count) {
+        MalStream *stream = ok_vec_get(&player->data.retiredStreams, i);
+        if (stream == streamInUse) {
+            i++;
+        } else {
+            ok_vec_remove_at(&player->data.retiredStreams, i);
+            malStreamRelease(stream);
+        }
+    }
+    if (all) {
+        ok_vec_deinit(&player->data.retiredBuffers);
+        ok_vec_init(&player->data.retiredBuffers);
+        ok_vec_deinit(&player->data.retiredStreams);
+        ok_vec_init(&player->data.retiredStreams);
+    }
+}
+
+static void _malContextMixerRenderCallback(pa_stream *stream, size_t length, void *userData) {
+    // Called on the mainloop thread, with the mainloop lock held.
+    MalContext *context = userData;
+    struct _MalContext *pa = &context->data;
+    const uint64_t startMicros = _malGetMicroseconds();
+    const size_t requestedLength = length;
+    void *dataBuffer;
+    if (pa_stream_begin_write(stream, &dataBuffer, &length) != PA_OK) {
+        _malRenderCountersAddCallback(&context->renderCounters, startMicros, requestedLength, 0,
+                                      0);
+        return;
+    }
+    MAL_TRACE_BEGIN("_malContextMixerRenderCallback");
+    const uint32_t frameSize = sizeof(float) * MAL_MIXER_NUM_CHANNELS;
+    const uint32_t numFrames = (uint32_t)(length / frameSize);
+    const double sampleRate = pa_stream_get_sample_spec(stream)->rate;
+    memset(dataBuffer, 0, numFrames * frameSize);
+    ok_vec_foreach(&pa->mixerPlayers, MalPlayer *player) {
+        MalBuffer *buffer = _malPlayerAcquireRenderBuffer(player);
+        MalStream *playerStream = _malPlayerAcquireRenderStream(player);
+        _malMixerRenderPlayer(player, buffer, playerStream, dataBuffer, numFrames,
+                              MAL_MIXER_NUM_CHANNELS, sampleRate,
+                              atomic_load(&player->data.totalGain), pa->mixerFrameTime);
+        _malPlayerReleaseRenderStream(player);
+        _malPlayerReleaseRenderBuffer(player);
+    }
+    pa->mixerFrameTime += numFrames;
+    pa_stream_write(stream, dataBuffer, numFrames * frameSize, NULL, 0, PA_SEEK_RELATIVE);
+    MAL_TRACE_END("_malContextMixerRenderCallback");
+    _malRenderCountersAddCallback(&context->renderCounters, startMicros, requestedLength,
+                                  numFrames * frameSize, numFrames * frameSize);
+}
+
+static void _malContextMixerUnderflowCallback(pa_stream *stream, void *userData) {
+    // Called on the mainloop thread. The mixer didn't keep up with the server.
+    (void)stream;
+    MalContext *context = userData;
+    _malRenderCountersAddUnderrun(&context->renderCounters);
+}
+
+static void _malContextMixerStreamStateCallback(pa_stream *stream, void *userData) {
+    // Called on the mainloop thread while connecting asynchronously
+    MalContext *context = userData;
+    pa_stream_state_t state = pa_stream_get_state(stream);
+    if (state == PA_STREAM_READY) {
+        pa_stream_set_state_callback(stream, NULL, NULL);
+        pa_stream_set_write_callback(stream, _malContextMixerRenderCallback, context);
+        pa_stream_set_underflow_callback(stream, _malContextMixerUnderflowCallback, context);
+        _malContextSetConnectResult(context, true);
+    } else if (!PA_STREAM_IS_GOOD(state)) {
+        pa_stream_set_state_callback(stream, NULL, NULL);
+        _malContextSetConnectResult(context, false);
+    }
+}
+
+// Creates the mixer stream. If `async` is true, returns without waiting for the stream to be
+// ready. The mainloop lock must be held.
+static bool _malContextInitMixer(MalContext *context, bool async) {
+    struct _MalContext *pa = &context->data;
+    double sampleRate = context->actualSampleRate;
+    if (sampleRate <= MAL_DEFAULT_SAMPLE_RATE) {
+        sampleRate = 44100;
+    }
+
+    pa_sample_spec sampleSpec;
+    sampleSpec.format = PA_SAMPLE_FLOAT32NE;
+    sampleSpec.rate = (uint32_t)sampleRate;
+    sampleSpec.channels = MAL_MIXER_NUM_CHANNELS;
+
+    // All players share this stream, so keep its buffer short by default.
+    double targetBufferDuration = context->targetLatency > 0.0 ? context->targetLatency : 0.05;
+    pa_buffer_attr bufferAttributes;
+    bufferAttributes.tlength = (uint32_t)(sizeof(float) * MAL_MIXER_NUM_CHANNELS *
+                                          (uint32_t)(targetBufferDuration * sampleRate));
+    bufferAttributes.maxlength = (uint32_t)-1;
+    bufferAttributes.minreq = (uint32_t)-1;
+    bufferAttributes.prebuf = 0;
+    bufferAttributes.fragsize = (uint32_t)-1;
+
+    int flags = (PA_STREAM_START_CORKED |       // Start paused, until the context is active
+                 PA_STREAM_ADJUST_LATENCY |     // Let server pick buffer metrics
+                 PA_STREAM_INTERPOLATE_TIMING | // For pa_stream_get_time()
+                 PA_STREAM_NOT_MONOTONIC |      // For pa_stream_get_time()
+                 PA_STREAM_AUTO_TIMING_UPDATE); // For pa_stream_get_time()
+
+    if (async) {
+        pa->mixerStream = _malPulseAudioConnectStream(pa, "Mixer Stream", &sampleSpec,
+                                                      &bufferAttributes, (pa_stream_flags_t)flags,
+                                                      _malContextMixerStreamStateCallback,
+                                                      context);
+        return (pa->mixerStream != NULL);
+    }
+    pa->mixerStream = _malPulseAudioCreateStream(pa, "Mixer Stream", &sampleSpec,
+                                                 &bufferAttributes, (pa_stream_flags_t)flags);
+    if (!pa->mixerStream) {
+        return false;
+    }
+    pa_stream_set_write_callback(pa->mixerStream, _malContextMixerRenderCallback, context);
+    pa_stream_set_underflow_callback(pa->mixerStream, _malContextMixerUnderflowCallback, context);
+    return true;
+}
+
+static void _malPulseAudioConnectServerInfoCallback(pa_context *c, const pa_server_info *info,
+                                                    void *userData) {
+    // Called on the mainloop thread while connecting asynchronously
+    (void)c;
+    MalContext *context = userData;
+    if (info) {
+        context->actualSampleRate = info->sample_spec.rate;
+    }
+    if (!context->softwareMixing) {
+        _malContextSetConnectResult(context, true);
+    } else if (!_malContextInitMixer(context, true)) {
+        _malContextSetConnectResult(context, false);
+    }
+}
+
+static void _malPulseAudioConnectStateCallback(pa_context *c, void *userData) {
+    // Called on the mainloop thread while connecting asynchronously
+    MalContext *context = userData;
+    pa_context_state_t state = pa_context_get_state(c);
+    if (state == PA_CONTEXT_READY) {
+        pa_context_set_state_callback(c, NULL, NULL);
+        pa_operation *operation = pa_context_get_server_info(
+            c, _malPulseAudioConnectServerInfoCallback, context);
+        if (operation) {
+            pa_operation_unref(operation);
+        } else {
+            _malContextSetConnectResult(context, false);
+        }
+    } else if (!PA_CONTEXT_IS_GOOD(state)) {
+        pa_context_set_state_callback(c, NULL, NULL);
+        _malContextSetConnectResult(context, false);
+    }
+}
+
+// Connects to the server. If `async` is true, returns once connecting has started, and the
+// connection finishes on the mainloop thread.
+static bool _malContextConnect(MalContext *context, const char **errorMissingAudioSystem,
+                               bool async) {
     struct _MalContext *pa = &context->data;
+    ok_vec_init(&pa->mixerPlayers);
+    ok_vec_init(&pa->batchPlayers);
+    ok_vec_init(&pa->streamPools);
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+    ok_queue_init(&pa->releasedBuffers);
+#endif
 
 #ifndef MAL_PULSEAUDIO_STATIC
     // Load libpulse library
@@ -267,6 +887,8 @@ static bool _malContextInit(MalContext *context, void *androidActivity,
     }
 #endif
 
+    pa->clockStart = pa_rtclock_now();
+
     // Create mainloop
     pa->mainloop = pa_threaded_mainloop_new();
     if (!pa->mainloop) {
@@ -279,12 +901,23 @@ static bool _malContextInit(MalContext *context, void *androidActivity,
         goto fail;
     }
 
-    // Connect context and wait for PA_CONTEXT_READY state
-    pa_context_state_t state = PA_CONTEXT_UNCONNECTED;
     pa_threaded_mainloop_lock(pa->mainloop);
     if (pa_threaded_mainloop_start(pa->mainloop) != PA_OK) {
         goto unlock_and_fail;
     }
+
+    if (async) {
+        pa_context_set_state_callback(pa->context, _malPulseAudioConnectStateCallback, context);
+        if (pa_context_connect(pa->context, NULL, PA_CONTEXT_NOFLAGS, NULL) != PA_OK) {
+            pa_context_set_state_callback(pa->context, NULL, NULL);
+            goto unlock_and_fail;
+        }
+        pa_threaded_mainloop_unlock(pa->mainloop);
+        return true;
+    }
+
+    // Connect context and wait for PA_CONTEXT_READY state
+    pa_context_state_t state = PA_CONTEXT_UNCONNECTED;
     pa_context_set_state_callback(pa->context, _malPulseAudioContextStateCallback, pa->mainloop);
     if (pa_context_connect(pa->context, NULL, PA_CONTEXT_NOFLAGS, NULL) == PA_OK) {
         while (1) {
@@ -305,6 +938,11 @@ static bool _malContextInit(MalContext *context, void *androidActivity,
     operation = pa_context_get_server_info(pa->context, _malPulseAudioServerInfoCallback, context);
     _malPulseAudioOperationWait(pa->mainloop, operation);
 
+    // Create mixer stream
+    if (context->softwareMixing && !_malContextInitMixer(context, false)) {
+        goto unlock_and_fail;
+    }
+
     // Success
     pa_threaded_mainloop_unlock(pa->mainloop);
     return true;
@@ -316,9 +954,47 @@ fail:
     return false;
 }
 
+static bool _malContextInit(MalContext *context, void *androidActivity,
+                            const char **errorMissingAudioSystem) {
+    (void)androidActivity;
+    return _malContextConnect(context, errorMissingAudioSystem, false);
+}
+
+static bool _malContextInitAsync(MalContext *context, void *androidActivity,
+                                 const char **errorMissingAudioSystem) {
+    (void)androidActivity;
+    return _malContextConnect(context, errorMissingAudioSystem, true);
+}
+
 static void _malContextDispose(MalContext *context) {
     struct _MalContext *pa = &context->data;
 
+    if (pa->mainloop) {
+        pa_threaded_mainloop_lock(pa->mainloop);
+        if (pa->context) {
+            // Stop a connection in progress
+            pa_context_set_state_callback(pa->context, NULL, NULL);
+        }
+        _malContextClearStreamPools(pa);
+        if (pa->mixerStream) {
+            pa_stream_set_state_callback(pa->mixerStream, NULL, NULL);
+            pa_stream_set_write_callback(pa->mixerStream, NULL, NULL);
+            pa_stream_set_underflow_callback(pa->mixerStream, NULL, NULL);
+            pa_stream_disconnect(pa->mixerStream);
+            pa_stream_unref(pa->mixerStream);
+            pa->mixerStream = NULL;
+        }
+        pa_threaded_mainloop_unlock(pa->mainloop);
+    }
+    ok_vec_deinit(&pa->mixerPlayers);
+    ok_vec_init(&pa->mixerPlayers);
+    ok_vec_deinit(&pa->batchPlayers);
+    ok_vec_init(&pa->batchPlayers);
+    ok_vec_foreach_ptr(&pa->streamPools, struct _MalStreamPool *pool) {
+        ok_vec_deinit(&pool->streams);
+    }
+    ok_vec_deinit(&pa->streamPools);
+    ok_vec_init(&pa->streamPools);
     if (pa->mainloop) {
         pa_threaded_mainloop_stop(pa->mainloop);
     }
@@ -331,10 +1007,30 @@ static void _malContextDispose(MalContext *context) {
         pa_threaded_mainloop_free(pa->mainloop);
         pa->mainloop = NULL;
     }
+    // The server connection is closed, so all zero-copy writes are finished
+    _malContextFreeReleasedBuffers(context);
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+    ok_queue_deinit(&pa->releasedBuffers);
+    ok_queue_init(&pa->releasedBuffers);
+#endif
 }
 
 static bool _malContextSetActive(MalContext *context, bool active) {
-    if (context->active != active) {
+    struct _MalContext *pa = &context->data;
+    if (context->active != active && pa->mixerStream) {
+        // Players keep their state; pausing the mixer stream pauses all of them.
+        pa_threaded_mainloop_lock(pa->mainloop);
+        pa_operation_unref(pa_stream_cork(pa->mixerStream, active ? 0 : 1, NULL, NULL));
+        pa_threaded_mainloop_unlock(pa->mainloop);
+        if (active) {
+            // Attach players created while the context was connecting
+            ok_vec_foreach(&context->players, MalPlayer *player) {
+                if (!player->data.mixerAttached) {
+                    _malPlayerInit(player, player->format);
+                }
+            }
+        }
+    } else if (context->active != active) {
         // When inactive, pause running streams, release stopped streams.
         // NOTE: Playback streams are a limited system-wide resource (32 on PulseAudio 4.0 and
         // older, 256 on PulseAudio 5.0 and newer).
@@ -364,6 +1060,12 @@ static bool _malContextSetActive(MalContext *context, bool active) {
                 }
             }
         }
+        if (!active) {
+            // Pooled streams are created again as needed
+            pa_threaded_mainloop_lock(pa->mainloop);
+            _malContextClearStreamPools(pa);
+            pa_threaded_mainloop_unlock(pa->mainloop);
+        }
     }
     return true;
 }
@@ -376,6 +1078,146 @@ static void _malContextUpdateGain(MalContext *context) {
     ok_vec_apply(&context->players, _malPlayerUpdateGain);
 }
 
+static bool _malContextIsFormatValid(const MalContext *context, MalFormat format) {
+    (void)context;
+    if (format.numChannels == 0 || format.numChannels > MAL_MAX_CHANNELS) {
+        return false;
+    } else if (format.isFloat) {
+        return format.bitDepth == 32;
+    } else {
+        return (format.bitDepth == 8 || format.bitDepth == 16 || format.bitDepth == 24 ||
+                format.bitDepth == 32);
+    }
+}
+
+static bool _malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer) {
+    (void)context;
+    (void)numFrames;
+    (void)outBuffer;
+    // Not supported: the audio system renders on its own thread
+    return false;
+}
+
+static bool _malContextGetTime(MalContext *context, double *time) {
+    struct _MalContext *pa = &context->data;
+    if (!pa->mainloop || context->connecting) {
+        return false;
+    }
+    if (pa->mixerStream) {
+        // The mixer stream's playback position, which uses the same timeline as `mixerFrameTime`
+        pa_usec_t usec = 0;
+        pa_threaded_mainloop_lock(pa->mainloop);
+        if (pa_stream_get_time(pa->mixerStream, &usec) == PA_OK) {
+            *time = (double)usec / 1000000.0;
+        } else {
+            // No timing info yet
+            *time = (double)pa->mixerFrameTime / malContextGetSampleRate(context);
+        }
+        pa_threaded_mainloop_unlock(pa->mainloop);
+    } else {
+        *time = (double)(pa_rtclock_now() - pa->clockStart) / 1000000.0;
+    }
+    return true;
+}
+
+static void _malContextCommitBatch(MalContext *context) {
+    struct _MalContext *pa = &context->data;
+    if (pa->batchPlayers.count == 0) {
+        return;
+    }
+    pa_threaded_mainloop_lock(pa->mainloop);
+    ok_vec_foreach(&pa->batchPlayers, MalPlayer *player) {
+        if (player->data.stream) {
+            if (player->data.muteChanged) {
+                _malPlayerSendMute(player);
+            }
+            if (player->data.gainChanged) {
+                _malPlayerSendGain(player);
+            }
+            if (player->data.corkChanged) {
+                pa_operation_unref(pa_stream_cork(player->data.stream, player->data.cork,
+                                                  NULL, NULL));
+            }
+        }
+        player->data.batched = false;
+        player->data.muteChanged = false;
+        player->data.gainChanged = false;
+        player->data.corkChanged = false;
+    }
+    pa_threaded_mainloop_unlock(pa->mainloop);
+    ok_vec_clear(&pa->batchPlayers);
+}
+
+static void _malContextPollEvents(MalContext *context) {
+    // Free buffers released by zero-copy writes even if no player is changed
+    _malContextFreeReleasedBuffers(context);
+}
+
+static bool _malContextPrewarm(MalContext *context, MalFormat format, uint32_t count) {
+    struct _MalContext *pa = &context->data;
+    if (!pa->mainloop || context->connecting) {
+        return false;
+    }
+    if (pa->mixerStream) {
+        // Players are attached to the mixer stream; there's nothing to prewarm
+        return true;
+    }
+    pa_sample_spec sampleSpec = _malPulseAudioGetSampleSpec(context, format);
+    bool success = true;
+
+    pa_threaded_mainloop_lock(pa->mainloop);
+    struct _MalStreamPool *pool = _malContextGetStreamPool(pa, &sampleSpec, true);
+    if (!pool) {
+        pa_threaded_mainloop_unlock(pa->mainloop);
+        return false;
+    }
+    if (pool->maxStreams < count) {
+        pool->maxStreams = count;
+    }
+
+    // Connect all the streams first, so the server round trips overlap
+    const size_t firstNewStream = pool->streams.count;
+    while (pool->streams.count < count) {
+        pa_stream *stream = _malPulseAudioConnectPlayerStream(pa, format, &sampleSpec,
+                                                              _malContextGetPlayerLatency(context),
+                                                              NULL, NULL);
+        if (!stream) {
+            success = false;
+            break;
+        }
+        ok_vec_push(&pool->streams, stream);
+    }
+    for (size_t i = firstNewStream; i < pool->streams.count;) {
+        pa_stream *stream = _malPulseAudioWaitForStream(pa, ok_vec_get(&pool->streams, i));
+        if (stream) {
+            i++;
+        } else {
+            success = false;
+            ok_vec_remove_at(&pool->streams, i);
+        }
+    }
+    pa_threaded_mainloop_unlock(pa->mainloop);
+    return success;
+}
+
+static uint32_t _malContextGetNumAudioSystemStreams(const MalContext *context) {
+    // The pools and the players' streams are only changed on the app thread, so no lock is needed
+    const struct _MalContext *pa = &context->data;
+    if (!pa->mainloop || context->connecting) {
+        return 0;
+    }
+    uint32_t count = pa->mixerStream ? 1 : 0;
+    ok_vec_foreach_ptr(&pa->streamPools, struct _MalStreamPool *pool) {
+        count += (uint32_t)pool->streams.count;
+    }
+    ok_vec_foreach(&context->players, MalPlayer *player) {
+        if (player->data.stream) {
+            count++;
+        }
+    }
+    return count;
+}
+
 // MARK: Player
 
 static void _malStreamStateCallback(pa_stream *stream, void *userData) {
@@ -384,40 +1226,350 @@ static void _malStreamStateCallback(pa_stream *stream, void *userData) {
     pa_threaded_mainloop_signal(mainloop, 0);
 }
 
-static void _malPlayerUnderflowCallback(pa_stream *stream, void *userData) {
-    (void)stream;
-    MalPlayer *player = userData;
-    MalStreamState expectedState = MAL_STREAM_DRAINING;
-    if (atomic_compare_exchange_strong(&player->streamState, &expectedState, MAL_STREAM_STOPPED)) {
+static void _malPulseAudioFillSilence(void *dst, MalFormat format, size_t length) {
+    const bool isUnsigned = !format.isFloat && format.bitDepth == 8;
+    memset(dst, isUnsigned ? 0x80 : 0, length);
+}
+
+/**
+ Gets the number of silent frames to write before the player's first frame, so that the first frame
+ plays at the player's `startFrame`. Uses the server's latency estimate. The mainloop lock must be
+ held.
+ */
+static uint64_t _malPlayerGetStartDelayFrames(MalPlayer *player, pa_stream *stream) {
+    if (player->startFrame == 0 || !player->context) {
+        return 0;
+    }
+    struct _MalContext *pa = &player->context->data;
+    double startTime = (double)player->startFrame / malContextGetSampleRate(player->context);
+    double playbackTime = (double)(pa_rtclock_now() - pa->clockStart) / 1000000.0;
+    const pa_timing_info *timingInfo = pa_stream_get_timing_info(stream);
+    if (timingInfo) {
+        playbackTime += (double)(timingInfo->sink_usec + timingInfo->transport_usec) / 1000000.0;
+    }
+    double delay = startTime - playbackTime;
+    if (delay <= 0.0) {
+        return 0;
+    }
+    return (uint64_t)(delay * pa_stream_get_sample_spec(stream)->rate + 0.5);
+}
+
+// Resets the render state of a player that starts playing its buffer. Resuming keeps the position.
+// The mainloop lock must be held.
+static void _malPlayerBufferDidStart(MalPlayer *player, pa_stream *stream) {
+    player->data.nextFrame = 0;
+    player->data.startDelayFrames = _malPlayerGetStartDelayFrames(player, stream);
+    player->adpcmDecoder.buffer = NULL;
+    player->data.renderGainSet = false;
+    _malFadeDidStart(&player->fade);
+}
+
+// Writes the remaining silence before a scheduled start. Returns the number of bytes written.
+static size_t _malPlayerWriteStartDelay(MalPlayer *player, void *dst, size_t length,
+                                        uint32_t frameSize) {
+    uint64_t numFrames = length / frameSize;
+    if (numFrames > player->data.startDelayFrames) {
+        numFrames = player->data.startDelayFrames;
+    }
+    player->data.startDelayFrames -= numFrames;
+    _malPulseAudioFillSilence(dst, player->format, (size_t)numFrames * frameSize);
+    return (size_t)numFrames * frameSize;
+}
+
+static void _malPlayerDidFinish(MalPlayer *player, MalStreamState streamState) {
+    if (atomic_compare_exchange_strong(&player->streamState, &streamState, MAL_STREAM_STOPPED)) {
         pa_operation_unref(pa_stream_cork(player->data.stream, 1, NULL, NULL));
         if (atomic_load(&player->hasOnFinishedCallback) && player->context) {
-            malPlayerRetain(player);
-            ok_queue_push(&player->context->finishedPlayersWithCallbacks, player);
+            _malContextQueueFinishedPlayer(player->context, player);
         }
     }
 }
 
-static void _malPlayerRenderCallback(pa_stream *stream, size_t length, void *userData) {
+// Returns true if the player's gain is applied in its render callback instead of by the server
+static bool _malPlayerHasSoftwareGain(const MalPlayer *player) {
+    return (player->context && (player->context->softwareGain ||
+                                atomic_load(&player->data.softwareFade)));
+}
+
+/**
+ With software gain, applies the context gain and the player's fade to `length` bytes of audio
+ about to be written. The context gain ramps from the gain of the previous write. Returns true if a
+ fade stopped the player, in which case the audio after the end of the fade is silenced. Only
+ called on the render thread.
+ */
+static bool _malPlayerApplySoftwareGain(MalPlayer *player, MalFormat format, double sampleRate,
+                                        void *data, size_t length) {
+    if (!_malPlayerHasSoftwareGain(player)) {
+        return false;
+    }
+    const uint32_t frameSize = (format.bitDepth / 8) * format.numChannels;
+    const uint32_t numFrames = (uint32_t)(length / frameSize);
+    const float targetGain = atomic_load(&player->data.totalGain);
+    const float gain = player->data.renderGainSet ? player->data.renderGain : targetGain;
+    const float gainStep = numFrames > 0 ? (targetGain - gain) / (float)numFrames : 0.0f;
+    player->data.renderGain = targetGain;
+    player->data.renderGainSet = true;
+
+    uint8_t *dst = data;
+    uint32_t frame = 0;
+    while (frame < numFrames) {
+        float fadeStartGain;
+        float fadeEndGain;
+        bool stopWhenFaded;
+        const uint32_t segmentFrames = _malFadeNext(&player->fade, numFrames - frame, sampleRate,
+                                                    &fadeStartGain, &fadeEndGain,
+                                                    &stopWhenFaded);
+        const float startGain = (gain + gainStep * (float)frame) * fadeStartGain;
+        frame += segmentFrames;
+        const float endGain = (gain + gainStep * (float)frame) * fadeEndGain;
+        _malApplyGain(dst, format, segmentFrames * format.numChannels, startGain, endGain);
+        dst += (size_t)segmentFrames * frameSize;
+        if (stopWhenFaded) {
+            _malPulseAudioFillSilence(dst, format, (size_t)(numFrames - frame) * frameSize);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Called on the render thread when a fade stops the player. It finishes when the server has played
+// the written audio.
+static void _malPlayerDidFade(MalPlayer *player) {
+    MalStreamState streamState = MAL_STREAM_PLAYING;
+    atomic_compare_exchange_strong(&player->streamState, &streamState, MAL_STREAM_DRAINING);
+}
+
+/**
+ Writes queued frames from the player's stream. If no frames are queued and `writeSilence` is
+ true, writes a short silence instead, so that the server keeps requesting data. An ended stream
+ finishes in the underflow callback. Returns the number of bytes written.
+ */
+static size_t _malPlayerRenderStream(MalPlayer *player, MalStream *playerStream,
+                                     pa_stream *stream, size_t length, bool writeSilence) {
+    const double silenceDuration = 0.01;
+    MalStreamState streamState = atomic_load(&player->streamState);
+    if (streamState != MAL_STREAM_STARTING && streamState != MAL_STREAM_RESUMING &&
+        streamState != MAL_STREAM_PLAYING) {
+        return 0;
+    }
+    if (!malContextIsFormatEqual(player->context, player->format, playerStream->format)) {
+        return 0;
+    }
+    if (streamState == MAL_STREAM_STARTING) {
+        player->data.startDelayFrames = _malPlayerGetStartDelayFrames(player, stream);
+        player->data.renderGainSet = false;
+        _malFadeDidStart(&player->fade);
+    }
+    const uint32_t frameSize = playerStream->frameSize;
+    const bool empty = (_malStreamGetNumQueuedFrames(playerStream) == 0 &&
+                        player->data.startDelayFrames == 0);
+    if (empty) {
+        if (!writeSilence || atomic_load(&playerStream->ended)) {
+            return 0;
+        }
+        const pa_sample_spec *sampleSpec = pa_stream_get_sample_spec(stream);
+        size_t silenceLength = frameSize * (size_t)(silenceDuration * sampleSpec->rate);
+        if (length > silenceLength) {
+            length = silenceLength;
+        }
+    }
+
+    void *dataBuffer;
+    if (length < frameSize || pa_stream_begin_write(stream, &dataBuffer, &length) != PA_OK) {
+        return 0;
+    }
+    pa_seek_mode_t seekMode = ((streamState == MAL_STREAM_STARTING) ?
+                               PA_SEEK_RELATIVE_ON_READ : PA_SEEK_RELATIVE);
+    if (streamState != MAL_STREAM_PLAYING) {
+        atomic_compare_exchange_strong(&player->streamState, &streamState, MAL_STREAM_PLAYING);
+    }
+    size_t bytesWritten;
+    if (empty) {
+        bytesWritten = length - (length % frameSize);
+        _malPulseAudioFillSilence(dataBuffer, player->format, bytesWritten);
+    } else {
+        bytesWritten = _malPlayerWriteStartDelay(player, dataBuffer, length, frameSize);
+        uint32_t numFrames = _malStreamRead(playerStream, (uint8_t *)dataBuffer + bytesWritten,
+                                            (uint32_t)((length - bytesWritten) / frameSize));
+        if (numFrames > 0) {
+            player->data.streamWritten = true;
+            _malStreamDidRead(playerStream);
+        }
+        bytesWritten += numFrames * frameSize;
+    }
+
+    bool faded = _malPlayerApplySoftwareGain(player, playerStream->format,
+                                             pa_stream_get_sample_spec(stream)->rate, dataBuffer,
+                                             bytesWritten);
+    pa_stream_write(stream, dataBuffer, bytesWritten, NULL, 0, seekMode);
+    if (faded) {
+        _malPlayerDidFade(player);
+    }
+    return bytesWritten;
+}
+
+static void _malPlayerUnderflowCallback(pa_stream *stream, void *userData) {
     MalPlayer *player = userData;
-    if (!OK_TRYLOCK(&player->data.lock)) {
-        // Edge case: buffer is being set
-        // ???: This may never happen, because corking a stream is locked and immediate?
-        return;
+    MalStreamState streamState = atomic_load(&player->streamState);
+    if (streamState == MAL_STREAM_DRAINING) {
+        _malPlayerDidFinish(player, streamState);
+    } else if (streamState == MAL_STREAM_PLAYING) {
+        MalStream *playerStream = _malPlayerAcquireRenderStream(player);
+        if (playerStream && _malStreamGetNumQueuedFrames(playerStream) == 0 &&
+            atomic_load(&playerStream->ended)) {
+            _malPlayerDidFinish(player, streamState);
+        } else if (playerStream) {
+            if (player->data.streamWritten) {
+                _malStreamDidUnderrun(playerStream);
+                _malPlayerDidUnderrun(player);
+            }
+            player->data.streamWritten = false;
+            // The server won't request more data until something is written
+            _malPlayerRenderStream(player, playerStream, stream, pa_stream_writable_size(stream),
+                                   true);
+        } else {
+            // The buffer wasn't written fast enough
+            _malPlayerDidUnderrun(player);
+        }
+        _malPlayerReleaseRenderStream(player);
+    }
+}
+
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+
+// Returns true if software gain changes the player's audio, so the buffer's data can't be passed
+// to the server directly
+static bool _malPlayerSoftwareGainChangesAudio(MalPlayer *player) {
+    return (_malPlayerHasSoftwareGain(player) &&
+            (atomic_load(&player->data.totalGain) != 1.0f ||
+             (player->data.renderGainSet && player->data.renderGain != 1.0f) ||
+             !_malFadeIsUnity(&player->fade)));
+}
+
+/**
+ Writes up to `length` bytes of the buffer, starting at the player's next frame, by passing the
+ buffer's data to the server. Each write holds a reference to the buffer until the server no
+ longer needs the data. The start delay, if any, is written first, and is the only data copied
+ (set in `bytesCopied`). Returns the number of bytes written.
+ */
+static size_t _malPlayerRenderBufferNoCopy(MalPlayer *player, MalBuffer *buffer,
+                                           pa_stream *stream, size_t length,
+                                           MalStreamState streamState, size_t *bytesCopied) {
+    pa_seek_mode_t seekMode = ((streamState == MAL_STREAM_STARTING) ?
+                               PA_SEEK_RELATIVE_ON_READ : PA_SEEK_RELATIVE);
+    if (streamState != MAL_STREAM_PLAYING &&
+        atomic_compare_exchange_strong(&player->streamState, &streamState, MAL_STREAM_PLAYING)) {
+        streamState = MAL_STREAM_PLAYING;
+    }
+    const uint32_t numFrames = buffer->numFrames;
+    const uint32_t frameSize = ((buffer->format.bitDepth / 8) * buffer->format.numChannels);
+    if (player->data.nextFrame >= numFrames) {
+        // The buffer was replaced with a shorter one while playing
+        player->data.nextFrame = 0;
+    }
+    size_t totalBytesWritten = 0;
+
+    if (player->data.startDelayFrames > 0) {
+        void *dataBuffer;
+        size_t delayLength = length;
+        if (pa_stream_begin_write(stream, &dataBuffer, &delayLength) != PA_OK) {
+            return 0;
+        }
+        size_t bytesWritten = _malPlayerWriteStartDelay(player, dataBuffer, delayLength,
+                                                        frameSize);
+        pa_stream_write(stream, dataBuffer, bytesWritten, NULL, 0, seekMode);
+        seekMode = PA_SEEK_RELATIVE;
+        length = bytesWritten < length ? length - bytesWritten : 0;
+        totalBytesWritten += bytesWritten;
+        *bytesCopied = bytesWritten;
+    }
+
+    const uint8_t *src = buffer->managedData;
+    while (length >= frameSize) {
+        uint32_t playerFrames = numFrames - player->data.nextFrame;
+        uint32_t maxFrames = (uint32_t)(length / frameSize);
+        uint32_t writeFrames = playerFrames < maxFrames ? playerFrames : maxFrames;
+        size_t writeBytes = (size_t)writeFrames * frameSize;
+
+        if (writeBytes == 0) {
+            break;
+        }
+
+        // Released in _malPulseAudioBufferWriteDidFinish()
+        malBufferRetain(buffer);
+        if (pa_stream_write_ext_free(stream, src + (size_t)player->data.nextFrame * frameSize,
+                                     writeBytes, _malPulseAudioBufferWriteDidFinish, buffer, 0,
+                                     seekMode) != PA_OK) {
+            _malPulseAudioBufferWriteDidFinish(buffer);
+            break;
+        }
+        seekMode = PA_SEEK_RELATIVE;
+        player->data.nextFrame += writeFrames;
+        length -= writeBytes;
+        totalBytesWritten += writeBytes;
+
+        if (player->data.nextFrame >= buffer->numFrames) {
+            player->data.nextFrame = 0;
+            if (!atomic_load(&player->looping)) {
+                if (streamState == MAL_STREAM_PLAYING) {
+                    atomic_compare_exchange_strong(&player->streamState, &streamState,
+                                                   MAL_STREAM_DRAINING);
+                }
+                break;
+            }
+        }
+    }
+    return totalBytesWritten;
+}
+
+#endif
+
+/**
+ Writes up to `length` bytes of the player's buffer or stream. Returns the number of bytes written,
+ and sets `bytesCopied` to the number of those bytes copied into the server's memory.
+ */
+static size_t _malPlayerRender(MalPlayer *player, pa_stream *stream, size_t length,
+                               size_t *bytesCopied) {
+    *bytesCopied = 0;
+    MalStream *playerStream = _malPlayerAcquireRenderStream(player);
+    if (playerStream) {
+        // On start, the server's buffer is empty, so keep it fed even if the stream is empty
+        bool starting = atomic_load(&player->streamState) == MAL_STREAM_STARTING;
+        size_t bytesWritten = _malPlayerRenderStream(player, playerStream, stream, length,
+                                                     starting);
+        _malPlayerReleaseRenderStream(player);
+        *bytesCopied = bytesWritten;
+        return bytesWritten;
     }
-    MalBuffer *buffer = player->buffer;
+    _malPlayerReleaseRenderStream(player);
+
+    MalBuffer *buffer = _malPlayerAcquireRenderBuffer(player);
     MalStreamState streamState = atomic_load(&player->streamState);
     if (streamState == MAL_STREAM_PAUSING || streamState == MAL_STREAM_PAUSED ||
         streamState == MAL_STREAM_DRAINING || streamState == MAL_STREAM_STOPPING ||
         streamState == MAL_STREAM_STOPPED ||
         buffer == NULL || buffer->managedData == NULL) {
-        OK_UNLOCK(&player->data.lock);
-        return;
+        _malPlayerReleaseRenderBuffer(player);
+        return 0;
+    }
+    if (streamState == MAL_STREAM_STARTING) {
+        // Before choosing how to write, since the start resets the fade
+        _malPlayerBufferDidStart(player, stream);
     }
 
+#ifdef MAL_PULSEAUDIO_ZERO_COPY
+    if (buffer->adpcmBlockSize == 0 && !_malPlayerSoftwareGainChangesAudio(player)) {
+        size_t bytesWritten = _malPlayerRenderBufferNoCopy(player, buffer, stream, length,
+                                                           streamState, bytesCopied);
+        _malPlayerReleaseRenderBuffer(player);
+        return bytesWritten;
+    }
+#endif
+
     void *dataBuffer;
     if (pa_stream_begin_write(stream, &dataBuffer, &length) != PA_OK) {
-        OK_UNLOCK(&player->data.lock);
-        return;
+        _malPlayerReleaseRenderBuffer(player);
+        return 0;
     }
     pa_seek_mode_t seekMode = ((streamState == MAL_STREAM_STARTING) ?
                                PA_SEEK_RELATIVE_ON_READ : PA_SEEK_RELATIVE);
@@ -427,11 +1579,14 @@ static void _malPlayerRenderCallback(pa_stream *stream, size_t length, void *use
     }
     const uint32_t numFrames = buffer->numFrames;
     const uint32_t frameSize = ((buffer->format.bitDepth / 8) * buffer->format.numChannels);
-    size_t bytesWritten = 0;
-    uint8_t *dst = dataBuffer;
-    uint32_t dstRemaining = (uint32_t)length;
-    uint8_t *src = buffer->managedData;
-    src += player->data.nextFrame * frameSize;
+    if (player->data.nextFrame >= numFrames) {
+        // The buffer was replaced with a shorter one while playing
+        player->data.nextFrame = 0;
+    }
+    size_t bytesWritten = _malPlayerWriteStartDelay(player, dataBuffer, length, frameSize);
+    uint8_t *dst = (uint8_t *)dataBuffer + bytesWritten;
+    uint32_t dstRemaining = (uint32_t)(length - bytesWritten);
+    const uint8_t *src = buffer->managedData;
     while (dstRemaining > 0) {
         uint32_t playerFrames = numFrames - player->data.nextFrame;
         uint32_t maxFrames = dstRemaining / frameSize;
@@ -442,18 +1597,20 @@ static void _malPlayerRenderCallback(pa_stream *stream, size_t length, void *use
             break;
         }
 
-        memcpy(dst, src, copyBytes);
+        if (buffer->adpcmBlockSize > 0) {
+            _malAdpcmDecoderRead(&player->adpcmDecoder, buffer, player->data.nextFrame,
+                                 copyFrames, (int16_t *)dst);
+        } else {
+            memcpy(dst, src + (size_t)player->data.nextFrame * frameSize, copyBytes);
+        }
         player->data.nextFrame += copyFrames;
         dst += copyBytes;
-        src += copyBytes;
         dstRemaining -= copyBytes;
         bytesWritten += copyBytes;
 
         if (player->data.nextFrame >= buffer->numFrames) {
             player->data.nextFrame = 0;
-            if (atomic_load(&player->looping)) {
-                src = buffer->managedData;
-            } else {
+            if (!atomic_load(&player->looping)) {
                 if (streamState == MAL_STREAM_PLAYING) {
                     atomic_compare_exchange_strong(&player->streamState, &streamState,
                                                    MAL_STREAM_DRAINING);
@@ -463,91 +1620,78 @@ static void _malPlayerRenderCallback(pa_stream *stream, size_t length, void *use
         }
     }
 
-    OK_UNLOCK(&player->data.lock);
+    bool faded = _malPlayerApplySoftwareGain(player, buffer->format,
+                                             pa_stream_get_sample_spec(stream)->rate, dataBuffer,
+                                             bytesWritten);
+    _malPlayerReleaseRenderBuffer(player);
 
     pa_stream_write(stream, dataBuffer, bytesWritten, NULL, 0, seekMode);
+    if (faded) {
+        _malPlayerDidFade(player);
+    }
+    *bytesCopied = bytesWritten;
+    return bytesWritten;
+}
+
+static void _malPlayerRenderCallback(pa_stream *stream, size_t length, void *userData) {
+    MalPlayer *player = userData;
+    const uint64_t startMicros = _malGetMicroseconds();
+    MAL_TRACE_BEGIN("_malPlayerRenderCallback");
+    size_t bytesCopied;
+    size_t bytesWritten = _malPlayerRender(player, stream, length, &bytesCopied);
+    MAL_TRACE_END("_malPlayerRenderCallback");
+    _malRenderCountersAddCallback(&player->renderCounters, startMicros, length, bytesWritten,
+                                  bytesCopied);
+    if (player->context) {
+        _malRenderCountersAddCallback(&player->context->renderCounters, startMicros, length,
+                                      bytesWritten, bytesCopied);
+    }
 }
 
 static bool _malPlayerInit(MalPlayer *player, MalFormat format) {
     if (!player->context) {
         return false;
     }
-    if (player->data.stream) {
+    if (player->context->connecting) {
+        // The stream is created when the context is activated
+        return true;
+    }
+    if (player->data.stream || player->data.mixerAttached) {
         _malPlayerDispose(player);
     }
-
-    const int n = 1;
-    const bool isLittleEndian = *(const char *)&n == 1;
-    struct _MalContext *pa = &player->context->data;
-    double sampleRate = (format.sampleRate <= MAL_DEFAULT_SAMPLE_RATE ?
-                         malContextGetSampleRate(player->context) : format.sampleRate);
-
-    pa_sample_format_t sampleFormat;
-    switch (player->format.bitDepth) {
-        case 8:
-            sampleFormat = PA_SAMPLE_U8;
-            break;
-        case 16: default:
-            sampleFormat = isLittleEndian ? PA_SAMPLE_S16LE : PA_SAMPLE_S16BE;
-            break;
-        case 24:
-            sampleFormat = isLittleEndian ? PA_SAMPLE_S24LE : PA_SAMPLE_S24BE;
-            break;
-        case 32:
-            sampleFormat = isLittleEndian ? PA_SAMPLE_S32LE : PA_SAMPLE_S32BE;
-            break;
+    if (player->context->data.mixerStream) {
+        struct _MalContext *pa = &player->context->data;
+        pa_threaded_mainloop_lock(pa->mainloop);
+        ok_vec_push(&pa->mixerPlayers, player);
+        player->data.mixerAttached = true;
+        pa_threaded_mainloop_unlock(pa->mainloop);
+        _malPlayerUpdateGain(player);
+        return true;
     }
 
-    pa_sample_spec sampleSpec;
-    sampleSpec.format = sampleFormat;
-    sampleSpec.rate = (uint32_t)sampleRate;
-    sampleSpec.channels = format.numChannels;
-
-    double targetBufferDuration = 0.5;
-    pa_buffer_attr bufferAttributes;
-    bufferAttributes.tlength = ((player->format.bitDepth / 8) *
-                                player->format.numChannels *
-                                (uint32_t)(targetBufferDuration * sampleRate));
-    bufferAttributes.maxlength = (uint32_t)-1;
-    bufferAttributes.minreq = (uint32_t)-1;
-    bufferAttributes.prebuf = 0;
-    bufferAttributes.fragsize = (uint32_t)-1;
+    struct _MalContext *pa = &player->context->data;
+    pa_sample_spec sampleSpec = _malPulseAudioGetSampleSpec(player->context, format);
 
     pa_threaded_mainloop_lock(pa->mainloop);
 
-    pa_channel_map channelMap;
-    if (!pa_channel_map_init_auto(&channelMap, format.numChannels, PA_CHANNEL_MAP_WAVEEX)) {
-        goto quit;
+    const double latency = _malPlayerGetTargetLatency(player);
+    pa_stream *stream = _malContextTakePooledStream(pa, &sampleSpec);
+    if (stream && latency != _malContextGetPlayerLatency(player->context)) {
+        // Pooled streams have the context's latency
+        pa_buffer_attr bufferAttributes = _malPulseAudioGetPlayerBufferAttr(format,
+                                                                            sampleSpec.rate,
+                                                                            latency);
+        pa_operation *operation = pa_stream_set_buffer_attr(stream, &bufferAttributes,
+                                                            NULL, NULL);
+        if (operation) {
+            pa_operation_unref(operation);
+        }
     }
-
-    int flags = (PA_STREAM_START_CORKED |       // Start paused
-                 PA_STREAM_ADJUST_LATENCY |     // Let server pick buffer metrics
-                 PA_STREAM_INTERPOLATE_TIMING | // For pa_stream_get_time()
-                 PA_STREAM_NOT_MONOTONIC |      // For pa_stream_get_time()
-                 PA_STREAM_AUTO_TIMING_UPDATE | // For pa_stream_get_time()
-                 PA_STREAM_VARIABLE_RATE);      // For pa_stream_update_sample_rate()
-
-    pa_stream *stream = pa_stream_new(pa->context, "Playback Stream", &sampleSpec, &channelMap);
     if (!stream) {
-        goto quit;
+        stream = _malPulseAudioConnectPlayerStream(pa, format, &sampleSpec, latency, NULL, NULL);
+        stream = _malPulseAudioWaitForStream(pa, stream);
     }
-
-    pa_stream_state_t state = PA_STREAM_UNCONNECTED;
-    pa_stream_set_state_callback(stream, _malStreamStateCallback, pa->mainloop);
-    if (pa_stream_connect_playback(stream, NULL, &bufferAttributes,
-                                   (pa_stream_flags_t)flags, NULL, NULL) == PA_OK) {
-        while (1) {
-            state = pa_stream_get_state(stream);
-            if (state == PA_STREAM_READY || !PA_STREAM_IS_GOOD(state)) {
-                break;
-            }
-            pa_threaded_mainloop_wait(pa->mainloop);
-        }
-    }
-    pa_stream_set_state_callback(stream, NULL, NULL);
-
-    if (state != PA_STREAM_READY) {
-        pa_stream_unref(stream);
+    if (!stream) {
         goto quit;
     }
 
@@ -561,6 +1705,12 @@ quit:
     if (player->data.stream) {
         _malPlayerUpdateMute(player);
         _malPlayerUpdateGain(player);
+        if (malPlayerGetState(player) == MAL_PLAYER_STATE_PLAYING) {
+            // Started while the context was connecting
+            pa_threaded_mainloop_lock(pa->mainloop);
+            pa_operation_unref(pa_stream_cork(player->data.stream, 0, NULL, NULL));
+            pa_threaded_mainloop_unlock(pa->mainloop);
+        }
     }
 
     return (player->data.stream != NULL);
@@ -568,60 +1718,174 @@ quit:
 
 static void _malPlayerDispose(MalPlayer *player) {
     if (!player->context) {
+        _malPlayerReclaimBuffers(player, true);
         return;
     }
     struct _MalContext *pa = &player->context->data;
 
+    if (pa->mainloop && player->data.mixerAttached) {
+        pa_threaded_mainloop_lock(pa->mainloop);
+        ok_vec_remove(&pa->mixerPlayers, player);
+        pa_threaded_mainloop_unlock(pa->mainloop);
+
+        player->data.mixerAttached = false;
+    }
+    if (player->data.batched) {
+        ok_vec_remove(&pa->batchPlayers, player);
+        player->data.batched = false;
+        player->data.muteChanged = false;
+        player->data.gainChanged = false;
+        player->data.corkChanged = false;
+    }
     if (pa->mainloop && player->data.stream) {
         pa_threaded_mainloop_lock(pa->mainloop);
         pa_stream_set_write_callback(player->data.stream, NULL, NULL);
         pa_stream_set_underflow_callback(player->data.stream, NULL, NULL);
-        pa_stream_disconnect(player->data.stream);
-        pa_stream_unref(player->data.stream);
+        const bool defaultLatency = (_malPlayerGetTargetLatency(player) ==
+                                     _malContextGetPlayerLatency(player->context));
+        if (!defaultLatency || !_malContextReturnPooledStream(pa, player->data.stream)) {
+            pa_stream_disconnect(player->data.stream);
+            pa_stream_unref(player->data.stream);
+        }
         pa_threaded_mainloop_unlock(pa->mainloop);
 
         player->data.stream = NULL;
     }
+    _malPlayerReclaimBuffers(player, true);
 }
 
 static bool _malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer) {
-    OK_LOCK(&player->data.lock);
+    MalBuffer *oldBuffer = atomic_load(&player->data.renderBuffer);
     player->buffer = buffer;
-    OK_UNLOCK(&player->data.lock);
+    atomic_store(&player->data.renderBuffer, buffer);
+    if (oldBuffer) {
+        // The render thread may still be reading the old buffer
+        malBufferRetain(oldBuffer);
+        ok_vec_push(&player->data.retiredBuffers, oldBuffer);
+    }
+    _malPlayerReclaimBuffers(player, false);
     return true;
 }
 
-static void _malPlayerUpdateMute(MalPlayer *player) {
-    if (player && player->context && player->data.stream) {
-        struct _MalContext *pa = &player->context->data;
-        bool mute = player->context->mute || player->mute;
+static bool _malPlayerSetStream(MalPlayer *player, MalStream *stream) {
+    MalStream *oldStream = atomic_load(&player->data.renderStream);
+    player->stream = stream;
+    atomic_store(&player->data.renderStream, stream);
+    if (oldStream) {
+        // The render thread may still be reading the old stream
+        malStreamRetain(oldStream);
+        ok_vec_push(&player->data.retiredStreams, oldStream);
+    }
+    _malPlayerReclaimBuffers(player, false);
+    return true;
+}
 
-        pa_threaded_mainloop_lock(pa->mainloop);
-        uint32_t index = pa_stream_get_index(player->data.stream);
-        pa_operation_unref(pa_context_set_sink_input_mute(pa->context, index, mute ? 1 : 0,
-                                                          NULL, NULL));
-        pa_threaded_mainloop_unlock(pa->mainloop);
+// Sets the gain applied by the mixer, or by the render callback with software gain, in addition to
+// the player's fade
+static void _malPlayerUpdateMixerGain(MalPlayer *player) {
+    bool mute = player->context->mute || player->mute;
+    atomic_store(&player->data.totalGain, mute ? 0.0f : player->context->gain);
+}
+
+// Sends the player's mute state to the server. With software gain, the server's stream is never
+// muted. The mainloop lock must be held.
+static void _malPlayerSendMute(MalPlayer *player) {
+    struct _MalContext *pa = &player->context->data;
+    bool mute = (!_malPlayerHasSoftwareGain(player) &&
+                 (player->context->mute || player->mute));
+    uint32_t index = pa_stream_get_index(player->data.stream);
+    pa_operation_unref(pa_context_set_sink_input_mute(pa->context, index, mute ? 1 : 0,
+                                                      NULL, NULL));
+}
+
+// Sends the player's gain to the server. With software gain, the server's volume is 1.0. The
+// mainloop lock must be held.
+static void _malPlayerSendGain(MalPlayer *player) {
+    struct _MalContext *pa = &player->context->data;
+    float gain = (_malPlayerHasSoftwareGain(player) ? 1.0f :
+                  player->context->gain * player->gain);
+
+    pa_volume_t volume = pa_sw_volume_from_linear((double)gain);
+    pa_cvolume cvolume;
+    cvolume.channels = player->format.numChannels;
+    for (int i = 0; i < cvolume.channels; i++) {
+        cvolume.values[i] = volume;
     }
+
+    uint32_t index = pa_stream_get_index(player->data.stream);
+    pa_operation_unref(pa_context_set_sink_input_volume(pa->context, index, &cvolume,
+                                                        NULL, NULL));
 }
 
-static void _malPlayerUpdateGain(MalPlayer *player) {
-    if (player && player->context && player->data.stream) {
-        struct _MalContext *pa = &player->context->data;
-        float gain = player->context->gain * player->gain;
+// Returns true if the player's changes should be deferred until the batch is committed.
+static bool _malPlayerAddToBatch(MalPlayer *player) {
+    if (player->context->batchDepth == 0) {
+        return false;
+    }
+    if (!player->data.batched) {
+        ok_vec_push(&player->context->data.batchPlayers, player);
+        player->data.batched = true;
+    }
+    return true;
+}
 
-        pa_volume_t volume = pa_sw_volume_from_linear((double)gain);
-        pa_cvolume cvolume;
-        cvolume.channels = player->format.numChannels;
-        for (int i = 0; i < cvolume.channels; i++) {
-            cvolume.values[i] = volume;
+static void _malPlayerUpdateMute(MalPlayer *player) {
+    if (player && player->context &&
+        (player->data.mixerAttached || _malPlayerHasSoftwareGain(player))) {
+        _malPlayerUpdateMixerGain(player);
+    } else if (player && player->context && player->data.stream) {
+        if (_malPlayerAddToBatch(player)) {
+            player->data.muteChanged = true;
+        } else {
+            struct _MalContext *pa = &player->context->data;
+            pa_threaded_mainloop_lock(pa->mainloop);
+            _malPlayerSendMute(player);
+            pa_threaded_mainloop_unlock(pa->mainloop);
         }
+    }
+}
 
-        pa_threaded_mainloop_lock(pa->mainloop);
-        uint32_t index = pa_stream_get_index(player->data.stream);
-        pa_operation_unref(pa_context_set_sink_input_volume(pa->context, index, &cvolume,
-                                                            NULL, NULL));
-        pa_threaded_mainloop_unlock(pa->mainloop);
+static void _malPlayerUpdateGain(MalPlayer *player) {
+    if (player && player->context &&
+        (player->data.mixerAttached || _malPlayerHasSoftwareGain(player))) {
+        _malPlayerUpdateMixerGain(player);
+    } else if (player && player->context && player->data.stream) {
+        if (_malPlayerAddToBatch(player)) {
+            player->data.gainChanged = true;
+        } else {
+            struct _MalContext *pa = &player->context->data;
+            pa_threaded_mainloop_lock(pa->mainloop);
+            _malPlayerSendGain(player);
+            pa_threaded_mainloop_unlock(pa->mainloop);
+        }
+    }
+}
+
+static bool _malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded) {
+    if (player->context && !player->data.mixerAttached && !_malPlayerHasSoftwareGain(player)) {
+        // Move the player's gain from the server to the render callback, which doesn't evaluate
+        // the fade until `softwareFade` is set.
+        player->fade.gain = player->gain;
+        player->fade.targetGain = player->gain;
+        player->fade.remainingFrames = 0;
+        player->fade.renderSerial = atomic_load(&player->fade.serial);
+        atomic_store(&player->data.softwareFade, true);
+        _malPlayerUpdateMixerGain(player);
+        if (player->data.stream) {
+            if (_malPlayerAddToBatch(player)) {
+                player->data.muteChanged = true;
+                player->data.gainChanged = true;
+            } else {
+                struct _MalContext *pa = &player->context->data;
+                pa_threaded_mainloop_lock(pa->mainloop);
+                _malPlayerSendMute(player);
+                _malPlayerSendGain(player);
+                pa_threaded_mainloop_unlock(pa->mainloop);
+            }
+        }
     }
+    _malFadePost(&player->fade, gain, duration, stopWhenFaded);
+    return true;
 }
 
 static bool _malPlayerSetLooping(MalPlayer *player, bool looping) {
@@ -632,7 +1896,8 @@ static bool _malPlayerSetLooping(MalPlayer *player, bool looping) {
 }
 
 static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
-    if (!player->context || !player->data.stream) {
+    if (!player->context || (!player->data.stream && !player->data.mixerAttached &&
+                             !player->context->connecting)) {
         return false;
     }
 
@@ -672,6 +1937,19 @@ static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
         }
 
         if (atomic_compare_exchange_strong(&player->streamState, &streamState, newStreamState)) {
+            if (player->data.mixerAttached) {
+                // The mixer picks up the new state on the next render
+                return true;
+            }
+            if (!player->data.stream) {
+                // Connecting. The state is applied when the stream is created.
+                return true;
+            }
+            if (_malPlayerAddToBatch(player)) {
+                player->data.corkChanged = true;
+                player->data.cork = shouldCork;
+                return true;
+            }
             struct _MalContext *pa = &player->context->data;
             pa_threaded_mainloop_lock(pa->mainloop);
             pa_operation_unref(pa_stream_cork(player->data.stream, shouldCork, NULL, NULL));
@@ -681,4 +1959,56 @@ static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
     }
 }
 
+static bool _malPlayerPlayAt(MalPlayer *player, uint64_t startFrame) {
+    player->startFrame = startFrame;
+    return _malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING);
+}
+
+static bool _malPlayerSetTargetLatency(MalPlayer *player, double latency) {
+    if (!player->context || player->context->data.mixerStream) {
+        // Not supported: all players share the mixer stream's latency
+        return false;
+    }
+    if (!player->data.stream) {
+        // Applied when the stream is created
+        return true;
+    }
+    struct _MalContext *pa = &player->context->data;
+    if (latency <= 0.0) {
+        latency = _malContextGetPlayerLatency(player->context);
+    }
+    pa_threaded_mainloop_lock(pa->mainloop);
+    const pa_sample_spec *sampleSpec = pa_stream_get_sample_spec(player->data.stream);
+    pa_buffer_attr bufferAttributes = _malPulseAudioGetPlayerBufferAttr(player->format,
+                                                                        sampleSpec->rate,
+                                                                        latency);
+    pa_operation *operation = pa_stream_set_buffer_attr(player->data.stream, &bufferAttributes,
+                                                        NULL, NULL);
+    if (operation) {
+        pa_operation_unref(operation);
+    }
+    pa_threaded_mainloop_unlock(pa->mainloop);
+    return (operation != NULL);
+}
+
+static bool _malPlayerGetLatency(MalPlayer *player, double *latency) {
+    if (!player->context) {
+        return false;
+    }
+    struct _MalContext *pa = &player->context->data;
+    pa_stream *stream = player->data.mixerAttached ? pa->mixerStream : player->data.stream;
+    if (!stream) {
+        return false;
+    }
+    pa_usec_t usec = 0;
+    int negative = 0;
+    pa_threaded_mainloop_lock(pa->mainloop);
+    bool success = (pa_stream_get_latency(stream, &usec, &negative) == PA_OK);
+    pa_threaded_mainloop_unlock(pa->mainloop);
+    if (success) {
+        *latency = negative ? 0.0 : (double)usec / 1000000.0;
+    }
+    return success;
+}
+
 #endif
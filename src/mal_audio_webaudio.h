@@ -40,6 +40,7 @@ struct _MalPlayer {
     int playerId;
 };
 
+#define MAL_USE_DEFAULT_FORMAT_IMPL
 #include "mal_audio_abstract.h"
 
 // MARK: Context
@@ -134,6 +135,45 @@ static void _malContextUpdateGain(MalContext *context) {
     }
 }
 
+static bool _malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer) {
+    (void)context;
+    (void)numFrames;
+    (void)outBuffer;
+    // Not supported: the audio system renders on its own thread
+    return false;
+}
+
+static bool _malContextGetTime(MalContext *context, double *time) {
+    (void)context;
+    (void)time;
+    // Not supported
+    return false;
+}
+
+static void _malContextCommitBatch(MalContext *context) {
+    (void)context;
+    // Do nothing. Changes are applied immediately.
+}
+
+static void _malContextPollEvents(MalContext *context) {
+    (void)context;
+    // Do nothing
+}
+
+static bool _malContextPrewarm(MalContext *context, MalFormat format, uint32_t count) {
+    (void)context;
+    (void)format;
+    (void)count;
+    // Not supported
+    return false;
+}
+
+static uint32_t _malContextGetNumAudioSystemStreams(const MalContext *context) {
+    (void)context;
+    // Not supported
+    return 0;
+}
+
 // MARK: Buffer
 
 static bool _malBufferInit(MalContext *context, MalBuffer *buffer,
@@ -242,6 +282,13 @@ static bool _malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer) {
     return true;
 }
 
+static bool _malPlayerSetStream(MalPlayer *player, MalStream *stream) {
+    (void)player;
+    (void)stream;
+    // Not supported
+    return false;
+}
+
 static void _malPlayerUpdateMute(MalPlayer *player) {
     _malPlayerUpdateGain(player);
 }
@@ -253,12 +300,39 @@ static void _malPlayerUpdateGain(MalPlayer *player) {
         EM_ASM_ARGS({
             var player = malContexts[$0].players[$1];
             if (player && player.gainNode) {
-                player.gainNode.gain.value = $2;;
+                player.gainNode.gain.cancelScheduledValues(0);
+                player.gainNode.gain.value = $2;
             }
         }, context->data.contextId, player->data.playerId, totalGain);
     }
 }
 
+static bool _malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded) {
+    // Web Audio evaluates the ramp on the audio thread. If the player isn't playing, the gain is
+    // set when it starts.
+    MalContext *context = player->context;
+    if (!context || !context->data.contextId || !player->data.playerId) {
+        return false;
+    }
+    float totalGain = player->mute ? 0.0f : gain;
+    EM_ASM_ARGS({
+        var contextData = malContexts[$0];
+        var player = contextData.players[$1];
+        if (player && player.gainNode) {
+            var now = contextData.context.currentTime;
+            var param = player.gainNode.gain;
+            param.cancelScheduledValues(now);
+            param.setValueAtTime(param.value, now);
+            param.linearRampToValueAtTime($2, now + $3);
+            if ($4 && player.sourceNode) {
+                // Calls onended, which finishes the player
+                player.sourceNode.stop(now + $3);
+            }
+        }
+    }, context->data.contextId, player->data.playerId, totalGain, duration, stopWhenFaded);
+    return true;
+}
+
 static bool _malPlayerSetLooping(MalPlayer *player, bool looping) {
     MalContext *context = player->context;
     if (context && context->data.contextId && player->data.playerId) {
@@ -391,13 +465,33 @@ static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
     }
 }
 
+static bool _malPlayerPlayAt(MalPlayer *player, uint64_t startFrame) {
+    (void)player;
+    (void)startFrame;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerSetTargetLatency(MalPlayer *player, double latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerGetLatency(MalPlayer *player, double *latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
 EMSCRIPTEN_KEEPALIVE
 static void _malPlayerFinished(uintptr_t playerPtr) {
     MalPlayer *player = (MalPlayer *)playerPtr;
     atomic_store(&player->streamState, MAL_STREAM_STOPPED);
     if (atomic_load(&player->hasOnFinishedCallback) && player->context) {
-        malPlayerRetain(player);
-        ok_queue_push(&player->context->finishedPlayersWithCallbacks, player);
+        _malContextQueueFinishedPlayer(player->context, player);
     }
 }
 
@@ -77,10 +77,15 @@ struct _MalPlayer {
     IXAudio2SourceVoice *sourceVoice;
     MalVoiceCallback *callback;
     _Atomic(bool) bufferQueued;
+    _Atomic(float) muteGain; // 0 if muted, otherwise 1. The player's gain is in its fade.
+    float renderVolume; // The source voice's volume. Only set on the XAudio2 thread once playing.
+    double sampleRate;
 };
 
 #define MAL_INCLUDE_SAMPLE_RATE_FUNCTIONS
+#define MAL_USE_DEFAULT_FORMAT_IMPL
 #define MAL_USE_DEFAULT_BUFFER_IMPL
+#define MAL_INCLUDE_FADE_FUNCTIONS
 #include "mal_audio_abstract.h"
 
 #pragma region Context
@@ -198,10 +203,73 @@ static void _malContextUpdateGain(MalContext *context) {
     context->data.masteringVoice->SetVolume(totalGain);
 }
 
+static bool _malContextRender(MalContext *context, uint32_t numFrames, float *outBuffer) {
+    (void)context;
+    (void)numFrames;
+    (void)outBuffer;
+    // Not supported: the audio system renders on its own thread
+    return false;
+}
+
+static bool _malContextGetTime(MalContext *context, double *time) {
+    (void)context;
+    (void)time;
+    // Not supported
+    return false;
+}
+
+static void _malContextCommitBatch(MalContext *context) {
+    (void)context;
+    // Do nothing. Changes are applied immediately.
+}
+
+static void _malContextPollEvents(MalContext *context) {
+    (void)context;
+    // Do nothing
+}
+
+static bool _malContextPrewarm(MalContext *context, MalFormat format, uint32_t count) {
+    (void)context;
+    (void)format;
+    (void)count;
+    // Not supported
+    return false;
+}
+
+static uint32_t _malContextGetNumAudioSystemStreams(const MalContext *context) {
+    (void)context;
+    // Not supported
+    return 0;
+}
+
 #pragma endregion
 
 #pragma region Player
 
+// Evaluates the player's fade for one processing pass, and applies it with the mute. XAudio2
+// smooths the volume change over the pass. Called on the XAudio2 thread.
+static void _malPlayerRenderFade(MalPlayer *player) {
+    const double passDuration = (double)XAUDIO2_QUANTUM_NUMERATOR / XAUDIO2_QUANTUM_DENOMINATOR;
+    const uint32_t passFrames = (uint32_t)(player->data.sampleRate * passDuration + 0.5);
+    bool stop;
+    const float gain = _malFadeAdvance(&player->fade, passFrames, player->data.sampleRate, &stop);
+    const float volume = atomic_load(&player->data.muteGain) * gain;
+    if (volume != player->data.renderVolume) {
+        player->data.renderVolume = volume;
+        player->data.sourceVoice->SetVolume(volume);
+    }
+    MalStreamState expectedStreamState = MAL_STREAM_PLAYING;
+    if (stop &&
+        MAL_COMPARE_EXCHANGE(&player->streamState, &expectedStreamState, MAL_STREAM_STOPPED)) {
+        player->data.sourceVoice->Stop();
+        // Resubmitted when played again
+        atomic_store(&player->data.bufferQueued, false);
+        if (atomic_load(&player->hasOnFinishedCallback) && player->context) {
+            _malContextQueueFinishedPlayer(player->context, player);
+        }
+    }
+}
+
 class MalVoiceCallback : public IXAudio2VoiceCallback {
 private:
     MalPlayer * player;
@@ -218,8 +286,7 @@ public:
         atomic_store(&player->data.bufferQueued, false);
         if (MAL_COMPARE_EXCHANGE(&player->streamState, &expectedStreamState, MAL_STREAM_STOPPED) &&
             atomic_load(&player->hasOnFinishedCallback) && player->context) {
-            malPlayerRetain(player);
-            ok_queue_push(&player->context->finishedPlayersWithCallbacks, player);
+            _malContextQueueFinishedPlayer(player->context, player);
         }
     }
 
@@ -228,6 +295,9 @@ public:
 
     void STDMETHODCALLTYPE OnVoiceProcessingPassStart(UINT32 bytesRequired) override {
         (void)bytesRequired;
+        if (atomic_load(&player->streamState) == MAL_STREAM_PLAYING) {
+            _malPlayerRenderFade(player);
+        }
     }
 
     void STDMETHODCALLTYPE OnBufferEnd(void *pBufferContext) override {
@@ -273,12 +343,16 @@ static bool _malPlayerInit(MalPlayer *player, MalFormat format) {
     xAudioFormat.nAvgBytesPerSec = (DWORD)sampleRate * xAudioFormat.nBlockAlign;
     xAudioFormat.cbSize = 0;
 
+    player->data.sampleRate = sampleRate;
     IXAudio2 *xAudio2 = player->context->data.xAudio2;
     HRESULT hr = xAudio2->CreateSourceVoice(&player->data.sourceVoice, &xAudioFormat, 0,
                                             XAUDIO2_DEFAULT_FREQ_RATIO, player->data.callback);
     bool success = SUCCEEDED(hr) && player->data.sourceVoice;
     if (success) {
+        // The voice hasn't started, so the XAudio2 thread isn't using the fade yet
         _malPlayerUpdateGain(player);
+        player->data.renderVolume = atomic_load(&player->data.muteGain) * player->fade.gain;
+        player->data.sourceVoice->SetVolume(player->data.renderVolume);
     }
     return success;
 }
@@ -319,15 +393,27 @@ static bool _malPlayerSetBuffer(MalPlayer *player, MalBuffer *buffer) {
     }
 }
 
+static bool _malPlayerSetStream(MalPlayer *player, MalStream *stream) {
+    (void)player;
+    (void)stream;
+    // Not supported
+    return false;
+}
+
 static void _malPlayerUpdateMute(MalPlayer *player) {
     _malPlayerUpdateGain(player);
 }
 
 static void _malPlayerUpdateGain(MalPlayer *player) {
-    if (player->data.sourceVoice) {
-        float totalGain = player->mute ? 0.0f : player->gain;
-        player->data.sourceVoice->SetVolume(totalGain);
-    }
+    // Applied with the fade at the start of the next processing pass. The player's gain is
+    // posted to the fade by malPlayerSetGain().
+    atomic_store(&player->data.muteGain, player->mute ? 0.0f : 1.0f);
+}
+
+static bool _malPlayerFadeTo(MalPlayer *player, float gain, double duration, bool stopWhenFaded) {
+    // Evaluated at the start of each processing pass
+    _malFadePost(&player->fade, gain, duration, stopWhenFaded);
+    return true;
 }
 
 static bool _malPlayerSetLooping(MalPlayer *player, bool looping) {
@@ -400,6 +486,27 @@ static bool _malPlayerSetState(MalPlayer *player, MalPlayerState state) {
     return true;
 }
 
+static bool _malPlayerPlayAt(MalPlayer *player, uint64_t startFrame) {
+    (void)player;
+    (void)startFrame;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerSetTargetLatency(MalPlayer *player, double latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
+static bool _malPlayerGetLatency(MalPlayer *player, double *latency) {
+    (void)player;
+    (void)latency;
+    // Not supported
+    return false;
+}
+
 #pragma endregion
 
 #endif
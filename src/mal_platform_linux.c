@@ -21,6 +21,8 @@
 
 #if defined(__linux__) && !defined(__ANDROID__)
 
+#define _GNU_SOURCE /* For clock_gettime */
+
 #include "mal_audio_pulseaudio.h"
 
 static void _malContextDidCreate(MalContext *context) {
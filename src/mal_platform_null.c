@@ -0,0 +1,44 @@
+/*
+ Mal
+ https://github.com/brackeen/mal
+ Copyright (c) 2014-2018 David Brackeen
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if defined(MAL_USE_NULL_AUDIO)
+
+#define _GNU_SOURCE /* For clock_gettime */
+
+#include "mal_audio_null.h"
+
+static void _malContextDidCreate(MalContext *context) {
+    (void)context;
+    // Do nothing
+}
+
+static void _malContextWillDispose(MalContext *context) {
+    (void)context;
+    // Do nothing
+}
+
+static void _malContextDidSetActive(MalContext *context, bool active) {
+    (void)context;
+    (void)active;
+    // Do nothing
+}
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ Mal
+ https://github.com/brackeen/mal
+ Copyright (c) 2014-2018 David Brackeen
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Tests of the render path. Uses the null audio system, so output can be rendered with
+// malContextRender() and checked sample by sample. Exits with a failure status if a check fails.
+
+#include "mal.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define kSampleRate 48000
+#define kMaxFrames 16
+
+static int testFailures = 0;
+
+#define TEST_CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%i: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+        testFailures++; \
+    } \
+} while (0)
+
+// Renders `numFrames` frames, and checks that both output channels match `expected`, which are
+// 16-bit samples. If `expected` is `NULL`, checks for silence.
+static void testRender(MalContext *context, const int16_t *expected, uint32_t numFrames,
+                       int line) {
+    float out[kMaxFrames * 2];
+    if (numFrames > kMaxFrames || !malContextRender(context, numFrames, out)) {
+        fprintf(stderr, "%s:%i: Render failed\n", __FILE__, line);
+        testFailures++;
+        return;
+    }
+    for (uint32_t i = 0; i < numFrames * 2; i++) {
+        const float value = expected ? (float)expected[i / 2] * (1.0f / 32768.0f) : 0.0f;
+        if (fabsf(out[i] - value) > 1e-6f) {
+            fprintf(stderr, "%s:%i: Frame %u: expected %f, got %f\n", __FILE__, line, i / 2,
+                    (double)value, (double)out[i]);
+            testFailures++;
+            return;
+        }
+    }
+}
+
+#define TEST_RENDER(context, expected, numFrames) \
+    testRender((context), (expected), (numFrames), __LINE__)
+
+static void testBufferPlayback(MalContext *context) {
+    const MalFormat format = { kSampleRate, 16, 1, false };
+    const int16_t data[] = { 1000, 2000, 3000, 4000 };
+    const int16_t dataThenSilence[] = { 1000, 2000, 3000, 4000, 0, 0 };
+    MalBuffer *buffer = malBufferCreate(context, format, 4, data);
+    MalPlayer *player = malPlayerCreate(context, format);
+    TEST_CHECK(buffer && player);
+    TEST_CHECK(malPlayerSetBuffer(player, buffer));
+
+    // Plays once, then stops
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+    TEST_RENDER(context, dataThenSilence, 6);
+    TEST_CHECK(malPlayerGetState(player) == MAL_PLAYER_STATE_STOPPED);
+
+    // Pausing keeps the position
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+    TEST_RENDER(context, data, 1);
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PAUSED));
+    TEST_RENDER(context, NULL, 2);
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+    TEST_RENDER(context, data + 1, 1);
+
+    // Stopping and playing again restarts from the first frame
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_STOPPED));
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+    TEST_RENDER(context, data, 4);
+
+    // Looping wraps to the first frame
+    TEST_CHECK(malPlayerSetLooping(player, true));
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_STOPPED));
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+    TEST_RENDER(context, data, 4);
+    TEST_RENDER(context, data, 4);
+    TEST_CHECK(malPlayerGetState(player) == MAL_PLAYER_STATE_PLAYING);
+
+    malPlayerRelease(player);
+    malBufferRelease(buffer);
+}
+
+static void testStreamUnderrunFunc(MalStream *stream, void *userData) {
+    (void)stream;
+    (*(int *)userData)++;
+}
+
+static void testStreamPlayback(MalContext *context) {
+    const MalFormat format = { kSampleRate, 16, 1, false };
+    const int16_t data[] = { 100, 200, 300, 400, 500, 600, 700 };
+    MalStream *stream = malStreamCreate(context, format, 4);
+    MalPlayer *player = malPlayerCreate(context, format);
+    TEST_CHECK(stream && player);
+    TEST_CHECK(malStreamGetCapacity(stream) == 4);
+    int numUnderruns = 0;
+    malStreamSetUnderrunFunc(stream, testStreamUnderrunFunc, &numUnderruns);
+    TEST_CHECK(malPlayerSetStream(player, stream));
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+
+    TEST_CHECK(malStreamWrite(stream, data, 3) == 3);
+    TEST_RENDER(context, data, 3);
+
+    // The next write starts at the end of the ring, and wraps to the start
+    TEST_CHECK(malStreamWrite(stream, data + 3, 4) == 4);
+    TEST_CHECK(malStreamWrite(stream, data, 1) == 0);
+    TEST_RENDER(context, data + 3, 4);
+    TEST_CHECK(malStreamGetNumQueuedFrames(stream) == 0);
+
+    // Running out of frames is one underrun, reported on the next poll
+    TEST_RENDER(context, NULL, 2);
+    TEST_RENDER(context, NULL, 2);
+    TEST_CHECK(malStreamGetUnderrunCount(stream) == 1);
+    TEST_CHECK(malPlayerGetRenderStats(player).numUnderruns == 1);
+    malContextPollEvents(context);
+    TEST_CHECK(numUnderruns == 1);
+    TEST_CHECK(malPlayerGetState(player) == MAL_PLAYER_STATE_PLAYING);
+
+    // Playback continues when frames are written again
+    TEST_CHECK(malStreamWrite(stream, data, 2) == 2);
+    TEST_RENDER(context, data, 2);
+
+    // An ended stream stops the player when its frames have been played
+    malStreamEnd(stream);
+    TEST_RENDER(context, NULL, 1);
+    TEST_CHECK(malPlayerGetState(player) == MAL_PLAYER_STATE_STOPPED);
+    TEST_CHECK(malStreamGetUnderrunCount(stream) == 1);
+
+    malPlayerRelease(player);
+    malStreamRelease(stream);
+}
+
+static void testAdpcmPlayback(MalContext *context) {
+    const MalFormat format = { kSampleRate, 16, 1, false };
+    // One IMA ADPCM block: predictor 1000, step index 20, then 8 nibbles (low nibble first)
+    const uint8_t block[] = { 0xe8, 0x03, 20, 0, 0x17, 0x3f, 0x80, 0xa9 };
+    // Decoded with the IMA reference algorithm
+    const int16_t expected[] = { 1000, 1093, 1132, 951, 1133, 1156, 1135, 1077, 989 };
+    MalBuffer *buffer = malBufferCreateAdpcm(context, format, 9, MAL_ADPCM_ENCODING_IMA,
+                                             sizeof(block), block);
+    MalPlayer *player = malPlayerCreate(context, format);
+    TEST_CHECK(buffer && player);
+    TEST_CHECK(malPlayerSetBuffer(player, buffer));
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+    TEST_RENDER(context, expected, 9);
+    TEST_RENDER(context, NULL, 1);
+
+    // Restarting decodes the block again
+    TEST_CHECK(malPlayerSetState(player, MAL_PLAYER_STATE_PLAYING));
+    TEST_RENDER(context, expected, 9);
+
+    malPlayerRelease(player);
+    malBufferRelease(buffer);
+}
+
+int main(void) {
+    MalContextConfig config = malContextGetDefaultConfig();
+    config.sampleRate = kSampleRate;
+    MalContext *context = malContextCreateWithConfig(&config, NULL);
+    if (!context) {
+        fprintf(stderr, "Error: Couldn't create audio context\n");
+        return EXIT_FAILURE;
+    }
+
+    testBufferPlayback(context);
+    testStreamPlayback(context);
+    testAdpcmPlayback(context);
+
+    malContextRelease(context);
+    if (testFailures > 0) {
+        fprintf(stderr, "%i checks failed\n", testFailures);
+        return EXIT_FAILURE;
+    }
+    printf("All tests passed\n");
+    return EXIT_SUCCESS;
+}